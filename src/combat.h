@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Combat rules shared by the watch app and tools/balance_sim.c. Nothing in
+// here may depend on pebble.h.
+
+// Constants for damage types, resistances, and stats
+#define NO_RESISTANCES 0
+#define SWORD_DAMAGE 1
+#define MAGIC_DAMAGE 2
+#define BOW_DAMAGE 4
+#define HEALTH_STAT 8
+
+// Stats a run starts with
+#define START_HEALTH 10
+#define START_DAMAGE 1
+
+// Most monsters an alias table can pick from
+#define ALIAS_MAX 64
+
+// Most enemies in one encounter, each battle has between one and this many.
+// Saves hold this many enemies, so bump SAVE_VERSION when it changes.
+#define MAX_ENEMIES 3
+
+// Damage in fifths that gets through, indexed by whether the monster
+// resists the damage type
+static const int damage_fifths[2] = { 5, 1 };
+
+// struct to hold monsters
+typedef struct {
+    const char* name;
+    uint16_t sprite;
+    uint16_t hit_chance;        // per-mille
+    uint8_t health;
+    uint8_t damage;
+    uint8_t resistances : 4;
+    uint8_t stat_boost : 4;
+} Monster;
+
+// Vose alias table: column i is picked with chance threshold[i] / 2^32,
+// otherwise alias[i] is
+typedef struct {
+    uint8_t count;
+    uint32_t threshold[ALIAS_MAX];
+    uint8_t alias[ALIAS_MAX];
+} AliasTable;
+
+// One xorshift32 step, state must never be zero
+static inline uint32_t combat_xorshift(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Maps a random word to [0, range), scaled rather than taken modulo to avoid bias
+static inline int combat_scale(uint32_t random, int range) {
+    return ((uint64_t) random * range) >> 32;
+}
+
+// Damage a hit of the given type does to a monster
+static inline int combat_damage(int damage, const Monster *monster, int type) {
+    int resisted = (monster->resistances & type) != 0;
+    return damage * damage_fifths[resisted] / 5;
+}
+
+// Whether the monster lands its counterattack, given a roll in [0, 1000)
+static inline bool combat_monster_hits(const Monster *monster, int roll) {
+    return roll < monster->hit_chance;
+}
+
+// Stat points gained since the start of the run, given the sum of the
+// damage stats of that many weapons
+static inline int combat_level(int max_health, int damage, int weapons) {
+    int level = max_health - START_HEALTH + damage - weapons * START_DAMAGE;
+    return level > 0 ? level : 0;
+}
+
+// Fills table so that entry i comes up in proportion to weights[i].
+// Integer weights keep it exact, so no column is left over by rounding.
+static inline void alias_build(AliasTable *table, const uint16_t *weights, int count) {
+    uint32_t scaled[ALIAS_MAX];
+    uint8_t small[ALIAS_MAX];
+    uint8_t large[ALIAS_MAX];
+    int smalls = 0;
+    int larges = 0;
+    uint32_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += weights[i];
+    }
+    // a column is full at total, weights are scaled so they average to that
+    for (int i = 0; i < count; i++) {
+        scaled[i] = weights[i] * count;
+        if (scaled[i] < total) {
+            small[smalls++] = i;
+        } else {
+            large[larges++] = i;
+        }
+    }
+    while (smalls > 0 && larges > 0) {
+        int less = small[--smalls];
+        int more = large[--larges];
+        table->threshold[less] = ((uint64_t) scaled[less] << 32) / total;
+        table->alias[less] = more;
+        scaled[more] -= total - scaled[less];
+        if (scaled[more] < total) {
+            small[smalls++] = more;
+        } else {
+            large[larges++] = more;
+        }
+    }
+    while (larges > 0) {
+        int full = large[--larges];
+        table->threshold[full] = UINT32_MAX;
+        table->alias[full] = full;
+    }
+    table->count = count;
+}
+
+// Picks an entry with a single random word: the high part of the scaled
+// word chooses the column and the fraction left over decides between the
+// column and its alias
+static inline int alias_sample(const AliasTable *table, uint32_t random) {
+    uint64_t scaled = (uint64_t) random * table->count;
+    int column = scaled >> 32;
+    return (uint32_t) scaled < table->threshold[column] ? column : table->alias[column];
+}
@@ -0,0 +1,101 @@
+#include "instrument.h"
+
+#ifdef INSTRUMENT
+
+uint32_t now_ms();
+
+static const char *probe_names[PROBE_COUNT] = {
+    "attack",
+    "query_accel",
+    "state_transition",
+    "battle_load",
+    "draw_health_bar",
+    "draw_weapon_icons",
+    "draw_journey_chart",
+    "draw_scene",
+};
+
+static ProbeStats probes[PROBE_COUNT];
+static PersistStats persist;
+static int budget_failures = 0;
+static TraceEvent trace[TRACE_LENGTH];
+static int trace_head = 0;
+static int trace_count = 0;
+
+ProbeStart instrument_begin(void) {
+    return (ProbeStart) { .time = now_ms() };
+}
+
+void instrument_end(Probe probe, ProbeStart started) {
+    uint32_t elapsed = now_ms() - started.time;
+    probes[probe].calls++;
+    probes[probe].total_ms += elapsed;
+    probes[probe].last_ms = elapsed;
+    if (elapsed > probes[probe].max_ms) {
+        probes[probe].max_ms = elapsed;
+    }
+}
+
+void instrument_persist_read(size_t bytes) {
+    persist.reads++;
+    persist.bytes_read += bytes;
+}
+
+void instrument_persist_write(size_t bytes) {
+    persist.writes++;
+    persist.bytes_written += bytes;
+}
+
+void instrument_bitmap_load(void) {
+    persist.bitmap_loads++;
+}
+
+void instrument_budget(const char *name, int value, int limit) {
+    bool ok = value <= limit;
+    if (!ok) {
+        budget_failures++;
+    }
+    APP_LOG(ok ? APP_LOG_LEVEL_DEBUG : APP_LOG_LEVEL_ERROR, "budget name=%s value=%d limit=%d result=%s",
+            name, value, limit, ok ? "ok" : "FAIL");
+}
+
+void instrument_trace(TraceType type, uint8_t arg) {
+    trace[trace_head] = (TraceEvent) { .time = now_ms(), .type = type, .arg = arg };
+    trace_head = (trace_head + 1) % TRACE_LENGTH;
+    if (trace_count < TRACE_LENGTH) {
+        trace_count++;
+    }
+}
+
+const ProbeStats* instrument_probe(Probe probe) {
+    return &probes[probe];
+}
+
+const PersistStats* instrument_persist(void) {
+    return &persist;
+}
+
+const TraceEvent* instrument_trace_event(int index) {
+    if (index < 0 || index >= trace_count) {
+        return NULL;
+    }
+    return &trace[(trace_head + TRACE_LENGTH - trace_count + index) % TRACE_LENGTH];
+}
+
+void instrument_dump(void) {
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        APP_LOG(APP_LOG_LEVEL_INFO, "probe name=%s calls=%d total_ms=%d max_ms=%d",
+                probe_names[i], (int) probes[i].calls, (int) probes[i].total_ms, (int) probes[i].max_ms);
+    }
+    APP_LOG(APP_LOG_LEVEL_INFO, "persist reads=%d bytes_read=%d writes=%d bytes_written=%d bitmap_loads=%d",
+            (int) persist.reads, (int) persist.bytes_read, (int) persist.writes,
+            (int) persist.bytes_written, (int) persist.bitmap_loads);
+    APP_LOG(APP_LOG_LEVEL_INFO, "budget_failures=%d", budget_failures);
+    const TraceEvent *event;
+    for (int i = 0; (event = instrument_trace_event(i)) != NULL; i++) {
+        APP_LOG(APP_LOG_LEVEL_INFO, "trace time=%d type=%d arg=%d", (int) event->time,
+                event->type, event->arg);
+    }
+}
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <pebble.h>
+
+// Lightweight hot-path instrumentation. Everything here compiles to
+// nothing unless INSTRUMENT is defined (./waf configure --instrument).
+
+// Instrumented functions
+typedef enum {
+    PROBE_ATTACK,
+    PROBE_QUERY_ACCEL,
+    PROBE_STATE_TRANSITION,
+    PROBE_BATTLE_LOAD,
+    PROBE_DRAW_HEALTH_BAR,
+    PROBE_DRAW_WEAPON_ICONS,
+    PROBE_DRAW_JOURNEY_CHART,
+    PROBE_DRAW_SCENE,
+    PROBE_COUNT
+} Probe;
+
+// Events kept in the trace ring buffer
+typedef enum {
+    TRACE_BUTTON,
+    TRACE_TRANSITION,
+    TRACE_ENCOUNTER,
+    TRACE_FLUSH,
+} TraceType;
+
+#define TRACE_LENGTH 32
+
+typedef struct {
+    uint32_t calls;
+    uint32_t total_ms;
+    uint32_t max_ms;
+    uint32_t last_ms;
+} ProbeStats;
+
+typedef struct {
+    uint32_t time;
+} ProbeStart;
+
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t bitmap_loads;
+} PersistStats;
+
+typedef struct {
+    uint32_t time;              // now_ms() when it happened
+    uint8_t type;
+    uint8_t arg;
+} TraceEvent;
+
+#ifdef INSTRUMENT
+
+ProbeStart instrument_begin(void);
+void instrument_end(Probe probe, ProbeStart started);
+void instrument_persist_read(size_t bytes);
+void instrument_persist_write(size_t bytes);
+void instrument_bitmap_load(void);
+void instrument_trace(TraceType type, uint8_t arg);
+// Logs a "budget" line comparing value against limit, failing if it is over
+void instrument_budget(const char *name, int value, int limit);
+// Logs every counter, budget failures and the trace as key=value lines
+void instrument_dump(void);
+
+const ProbeStats* instrument_probe(Probe probe);
+const PersistStats* instrument_persist(void);
+// Trace events from oldest (0) to newest, NULL past the end
+const TraceEvent* instrument_trace_event(int index);
+
+#define PROBE_BEGIN() ProbeStart probe_started = instrument_begin()
+#define PROBE_END(probe) instrument_end(probe, probe_started)
+
+#else
+
+#define instrument_persist_read(bytes)
+#define instrument_persist_write(bytes)
+#define instrument_bitmap_load()
+#define instrument_budget(name, value, limit)
+#define instrument_trace(type, arg)
+#define instrument_dump()
+#define PROBE_BEGIN()
+#define PROBE_END(probe)
+
+#endif
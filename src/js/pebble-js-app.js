@@ -0,0 +1,92 @@
+// Collects the telemetry batches sent by src/telemetry.c into long-term
+// totals, kept in localStorage under "telemetry".
+
+// Event types, in the order of TelemetryType in telemetry.h
+var BATTLE_WON = 0;
+var DIED = 1;
+var STAT_GAIN = 2;
+var TRAVEL = 3;
+
+var HEADER_BYTES = 6;
+var EVENT_BYTES = 6;
+
+// Stat constants from combat.h
+var STATS = { 1: 'sword', 2: 'magic', 4: 'bow', 8: 'health' };
+
+function loadTotals() {
+  var totals = JSON.parse(localStorage.getItem('telemetry') || 'null');
+  return totals || {
+    lastSeq: -1,      // newest batch counted
+    lastCount: 0,     // events counted from that batch
+    dropped: 0,
+    battles: 0,
+    enemies: 0,
+    attacks: 0,
+    deaths: {},       // monster index -> deaths
+    bestLevel: 0,
+    stats: {},        // stat name -> points gained
+    steps: 0,
+    stepsByDay: {}    // YYYY-MM-DD -> steps
+  };
+}
+
+function u16(bytes, offset) {
+  return bytes[offset] | (bytes[offset + 1] << 8);
+}
+
+function day(seconds) {
+  return new Date(seconds * 1000).toISOString().slice(0, 10);
+}
+
+function addEvent(totals, type, arg, value, time) {
+  if (type === BATTLE_WON) {
+    totals.battles++;
+    totals.enemies += arg;
+    totals.attacks += value;
+  } else if (type === DIED) {
+    totals.deaths[arg] = (totals.deaths[arg] || 0) + 1;
+    totals.bestLevel = Math.max(totals.bestLevel, value);
+  } else if (type === STAT_GAIN) {
+    var stat = STATS[arg] || arg;
+    totals.stats[stat] = (totals.stats[stat] || 0) + 1;
+  } else if (type === TRAVEL) {
+    totals.steps += value;
+    totals.stepsByDay[day(time)] = (totals.stepsByDay[day(time)] || 0) + value;
+  }
+}
+
+function addBatch(seq, bytes) {
+  var totals = loadTotals();
+  var base = u16(bytes, 0) + u16(bytes, 2) * 65536;
+  var count = (bytes.length - HEADER_BYTES) / EVENT_BYTES;
+  // A batch the watch could not see acknowledged is sent again with the
+  // same number, possibly with more events after the ones already counted.
+  // Numbering starts over at 0 when the watch app is reinstalled.
+  var skip = 0;
+  if (seq === totals.lastSeq) {
+    skip = totals.lastCount;
+  } else if (seq < totals.lastSeq && seq !== 0) {
+    console.log('Telemetry batch ' + seq + ' already counted.');
+    return;
+  } else {
+    totals.dropped += u16(bytes, 4);
+  }
+  for (var i = skip; i < count; i++) {
+    var event = HEADER_BYTES + i * EVENT_BYTES;
+    addEvent(totals, bytes[event], bytes[event + 1], u16(bytes, event + 2),
+             base + u16(bytes, event + 4));
+  }
+  totals.lastSeq = seq;
+  totals.lastCount = Math.max(count, skip);
+  localStorage.setItem('telemetry', JSON.stringify(totals));
+  console.log('Telemetry batch ' + seq + ': ' + (count - skip) + ' new events, ' +
+              totals.battles + ' battles won, ' + totals.steps + ' steps so far.');
+}
+
+Pebble.addEventListener('appmessage', function(e) {
+  var events = e.payload.telemetry_events;
+  if (events === undefined || events.length < HEADER_BYTES) {
+    return;
+  }
+  addBatch(e.payload.telemetry_seq, events);
+});
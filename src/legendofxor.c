@@ -1,22 +1,22 @@
 #include <pebble.h>
+#include "combat.h"
+#include "instrument.h"
+#include "telemetry.h"
 
 // the window
 static Window *window;
 
-// Constants for damage types, resistances, and stats
-#define NO_RESISTANCES 0
-#define SWORD_DAMAGE 1
-#define MAGIC_DAMAGE 2
-#define BOW_DAMAGE 4
-#define HEALTH_STAT 8
-
 // Constants for game states
 #define BATTLE 0
 #define TRAVEL 1
 #define WELCOME 2
 #define DEATH 3
+#define JOURNEY 4
+#define STATE_COUNT 5
 
 // Persistent storage keys
+// Keys 0-8 each held a single field in older versions. They are only
+// read once, to migrate an existing game into SAVE_KEY.
 #define PLAYER_MAX_HEALTH_KEY 0
 #define PLAYER_CURRENT_HEALTH_KEY 1
 #define PLAYER_SWORD_DAMAGE_KEY 2
@@ -26,557 +26,2213 @@ static Window *window;
 #define MONSTER_INDEX_KEY 6
 #define MONSTER_CURRENT_HEALTH_KEY 7
 #define STATE_KEY 8
-
-// How frequently random encounters should happen
-#define ENCOUNTER_FREQUENCY 70000
+#define SAVE_KEY 9
+#define JOURNAL_KEY 10
+#define JOURNEY_KEY 11
+// 12 is TELEMETRY_PERSIST_KEY in telemetry.h
+
+// Layout version of the save blob, bump whenever SaveGame changes
+#define SAVE_VERSION 4
+// Weapon stats a save holds, bump SAVE_VERSION along with it when a weapon
+// is added
+#define SAVE_WEAPONS 3
+// How long (in ms) changes are held in RAM before they are written out
+#define SAVE_FLUSH_DELAY 10000
+
+// Flags for which parts of the save have changed since the last flush
+#define SAVE_DIRTY_STATE 1
+#define SAVE_DIRTY_STATS 2
+#define SAVE_DIRTY_PLAYER_HEALTH 4
+#define SAVE_DIRTY_BATTLE 8
+#define SAVE_DIRTY_RNG 16
+#define SAVE_DIRTY_JOURNAL 32
+#define SAVE_DIRTY_TRAVEL 64
+#define SAVE_DIRTY_JOURNEY 128
+
+// Journal entry types
+#define JOURNAL_NEW_RUN 0
+#define JOURNAL_BUTTON 1
+#define JOURNAL_ENCOUNTER 2
+#define JOURNAL_PRELOAD 3
+#define JOURNAL_LONG_BUTTON 4
+
+// Number of journal entries kept, sized to fit one persist_write_data call
+#define JOURNAL_LENGTH 42
+
+// Journey history: hourly runs kept (sized like the journal), and the
+// number of steps each unit of a run's count stands for
+#define JOURNEY_RUNS 122
+#define JOURNEY_STEP_UNIT 50
+// Hours shown on the journey screen's chart
+#define JOURNEY_CHART_HOURS 24
+
+// Width in pixels of a full monster health bar
+#define HEALTH_BAR_WIDTH 75
+// Health bar drain animation: ms per frame, and the most frames one drain may take
+#define BAR_FRAME_INTERVAL 40
+#define BAR_MAX_FRAMES 8
+
+// Fixed-point scales of the win probability tables. wscript keeps monster
+// health low enough for the expected hits to fit a uint16_t.
+#define ODDS_ONE 32768          // probabilities, Q15
+#define ODDS_HIT 4096           // expected hits taken, Q12
+
+// Parts of the battle screen that changed and need repainting
+#define BATTLE_DIRTY_BAR 1
+#define BATTLE_DIRTY_PLAYER_HEALTH 2
+#define BATTLE_DIRTY_TARGET 4
+
+// Bytes reserved for the enemies and damage log of one battle
+#define BATTLE_ARENA_SIZE 512
+// Entries in the health distribution used for odds against several enemies.
+// Damage beyond this is counted as this much, which only matters for a
+// player with more health than that.
+#define ODDS_MAX_TAKEN 64
+
+// Budgets checked by instrumented builds: flash writes per battle and ms
+// per state transition. On the host build (tools/host) time includes the
+// stub's modeled flash and bitmap costs.
+#define BATTLE_FLASH_WRITE_BUDGET 6
+#define TRANSITION_BUDGET 100
+#define ENCOUNTER_FRAME_BUDGET 50
+// ms from launch to the first frame of the saved scene, and until the
+// deferred loads are done as well
+#define LAUNCH_FRAME_BUDGET 50
+#define LAUNCH_INTERACTIVE_BUDGET 100
+// Heap budgets: bytes each scene's retained layers may take, indexed by
+// state, and how much of the heap must stay free after a transition
+#ifdef INSTRUMENT
+static const int scene_build_budget[STATE_COUNT] = { 1536, 768, 768, 512, 768 };
+#endif
+#define HEAP_MIN_FREE 2048
+
+// Resource cache: slots, and how many bytes of bitmaps it may hold before
+// unused ones are evicted
+#define RESOURCE_CACHE_SIZE 8
+#define RESOURCE_CACHE_BUDGET 4096
+
+// How many steps are taken between random encounters
+#define ENCOUNTER_STEPS 500
+// Steps are checkpointed to flash after this many, and when travel ends
+#define TRAVEL_CHECKPOINT_STEPS 100
+// Once this percentage of ENCOUNTER_STEPS has been walked the next monster
+// is picked, and its sprite is loaded PRELOAD_DELAY ms later in its own slice
+#define PRELOAD_PERCENT 80
+#define PRELOAD_DELAY 250
+
+// Accelerometer samples per batch. At 10Hz this wakes the app every 2.5s.
+#define ACCEL_BATCH_SIZE 25
+// Step detector tuning, in milli-g of high-passed acceleration magnitude
+#define STEP_THRESHOLD 120
+#define STEP_HYSTERESIS 60
+// Minimum number of samples between two steps (10Hz, so ~3 steps/s max)
+#define STEP_MIN_GAP 3
+
+// After TRAVEL_IDLE_BATCHES batches with no step and nothing above
+// TRAVEL_NOISE_FLOOR (milli-g), travel stops streaming samples. It then only
+// peeks the accelerometer at intervals doubling from TRAVEL_PROBE_MIN to
+// TRAVEL_PROBE_MAX ms, and goes back to streaming on movement or a tap.
+#define TRAVEL_IDLE_BATCHES 4
+#define TRAVEL_NOISE_FLOOR 40
+#define TRAVEL_PROBE_MIN 5000
+#define TRAVEL_PROBE_MAX 300000
+// Below this charge an idle traveler is only woken by taps, never probed
+#define LOW_BATTERY_PERCENT 20
+
+// Root layer of each scene. Scenes are built on first entry, then only
+// hidden and shown until the window unloads.
+static Layer *battle_scene;
+static Layer *death_scene;
+static Layer *welcome_scene;
+static Layer *travel_scene;
+static Layer *journey_scene;
 
 // Text Fields
 static TextLayer *enemy_name;
 static TextLayer *player_health_label;
 static TextLayer *player_health;
 static TextLayer *death_text;
+static TextLayer *death_press_a_key;
 static TextLayer *welcome_text;
-static TextLayer *press_a_key;
+static TextLayer *welcome_press_a_key;
+static TextLayer *travel_text;
+static TextLayer *odds_text;
+static TextLayer *travel_hint;
+static TextLayer *journey_title;
+static TextLayer *journey_text;
+static TextLayer *journey_caption;
+static Layer *journey_chart;
 
 // Images/Sprites
-static BitmapLayer *sword_layer;
-static GBitmap *sword_icon;
-static BitmapLayer *magic_layer;
-static GBitmap *magic_icon;
-static BitmapLayer *bow_layer;
-static GBitmap *bow_icon;
+static Layer *weapon_layer;
+static GBitmap *weapon_atlas;
 static BitmapLayer *monster_layer;
 static GBitmap *monster_sprite;
 static Layer *monster_health_layer;
 
-// struct to hold monsters
+// A weapon's icon: where it sits in the WEAPON_ATLAS resource (packed by
+// tools/pack_atlas.py) and where it is drawn within weapon_layer
 typedef struct {
-    int health;
-    int resistances;
-    float hit_chance;
-    int damage;
-    uint32_t sprite;
-    int stat_boost;
-    const char* name;
-} Monster;
-
-static Monster tentacle_mage;
-static Monster ent;
-static Monster horned_guard;
-static Monster centaur_slaver;
-static Monster disturbed_wraith;
-static Monster eye_fiend;
-static Monster juvenile_wyrm;
-static Monster noxious_slime;
-static Monster pixel_golem;
-static Monster small_fish;
-static Monster vengeful_djinn;
-static Monster* monster_index[11];
+    int type;
+    GRect source;
+    GPoint position;
+} WeaponIcon;
+
+// WEAPON_ATLAS_* source rects, generated from the packed icons' sizes
+#include "src/weapon_atlas.auto.h"
+
+static const WeaponIcon weapon_icons[] = {
+    { SWORD_DAMAGE, WEAPON_ATLAS_SWORD, { 0, 0 } },
+    { MAGIC_DAMAGE, WEAPON_ATLAS_MAGIC, { 0, 55 } },
+    { BOW_DAMAGE, WEAPON_ATLAS_BOW, { 0, 120 } },
+};
+#define WEAPON_COUNT ((int) (sizeof(weapon_icons) / sizeof(weapon_icons[0])))
+// Indexes into weapon_icons, player_damage and each row of damage_matrix
+#define WEAPON_SWORD 0
+#define WEAPON_MAGIC 1
+#define WEAPON_BOW 2
+
+// sub-bitmaps of weapon_atlas, one per entry in weapon_icons
+static GBitmap *weapon_icon_bitmaps[WEAPON_COUNT];
+
+
+// monster_index[] and MONSTER_COUNT, generated from monsters.csv
+#include "src/monsters.auto.h"
+
+// Everything that survives an app restart, written with a single persist call.
+// Fields are only ever appended, so older (shorter) saves still load with
+// the newer fields zeroed.
+typedef struct __attribute__((__packed__)) {
+    uint8_t version;
+    uint8_t state;
+    int8_t monster_index;       // the only enemy before version 3, -1 when none
+    int16_t monster_health;
+    int16_t player_max_health;
+    int16_t player_current_health;
+    int16_t player_damage[SAVE_WEAPONS];   // indexed like weapon_icons
+    uint32_t rng_state;
+    uint8_t enemy_count;        // 0 when no encounter is pending
+    uint8_t target;
+    uint8_t enemy_monsters[MAX_ENEMIES];
+    int8_t enemy_health[MAX_ENEMIES];
+    int16_t movement_total;
+} SaveGame;
+
+// One recorded input. rng is the generator state just before the event,
+// so every entry doubles as a checkpoint when replaying.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type;
+    uint8_t arg;
+    uint32_t rng;
+} JournalEntry;
+
+// Ring buffer of the most recent inputs, kept in JOURNAL_KEY
+typedef struct __attribute__((__packed__)) {
+    uint8_t head;               // where the next entry goes
+    uint8_t count;
+    JournalEntry entries[JOURNAL_LENGTH];
+} Journal;
+
+// Steps in one or more consecutive hours that all rounded to the same count
+typedef struct __attribute__((__packed__)) {
+    uint8_t steps;              // in JOURNEY_STEP_UNITs
+    uint8_t hours;
+} JourneyRun;
+
+// Run-length coded steps per hour, kept in JOURNEY_KEY. When it fills up
+// the oldest runs are dropped, so it never takes more than one key.
+typedef struct __attribute__((__packed__)) {
+    uint32_t hour;              // hours since the epoch of the hour being counted
+    uint32_t total_steps;
+    uint16_t hour_steps;        // steps so far in that hour
+    uint8_t head;               // where the next run goes
+    uint8_t count;
+    JourneyRun runs[JOURNEY_RUNS];
+} JourneyLog;
+
+static Journal journal;
+static JourneyLog journey_log;
+// set while the journal is being replayed, so replayed inputs aren't recorded again
+static bool journal_replaying = false;
+// set once a replay has started. The game left in memory is the replay's,
+// so nothing is written over the player's save from then on.
+static bool journal_replayed = false;
+// the journal and journey log aren't needed for the first frame, they
+// are read after it or when first used
+static bool journal_loaded = false;
+static bool journey_log_loaded = false;
+
+// which SAVE_DIRTY_* fields differ from what is in flash
+static uint8_t save_dirty = 0;
+static AppTimer *save_timer = NULL;
+// number of persist writes since the current battle started
+static int battle_flash_writes = 0;
 
 // Player stats
 static int player_max_health;
-static int player_sword_damage;
-static int player_magic_damage;
-static int player_bow_damage;
+// damage stat of each weapon, indexed like weapon_icons
+static int player_damage[WEAPON_COUNT];
 
 
-// this holds a pointer to the monster currently being fought
-static Monster *current_battle;
-// This value holds the current health of the monster we're fighting
-static int current_monster_health = 0;
+// One enemy of the current encounter
+typedef struct {
+    uint8_t monster;            // index in monster_index
+    int8_t health;
+} Enemy;
+
+// One press of the current battle
+typedef struct {
+    uint8_t enemy;
+    uint8_t weapon;             // index in weapon_icons
+    uint8_t dealt;
+    uint8_t taken;
+} DamageEntry;
+
+// Everything per battle is bump-allocated from here and dropped all at once
+// when the battle scene unloads, so long fights can't fragment the heap
+static uint32_t battle_arena[BATTLE_ARENA_SIZE / sizeof(uint32_t)];
+static size_t battle_arena_used = 0;
+
+// The enemies of the pending or current encounter, 0 when there is none
+static Enemy *enemies = NULL;
+static int enemy_count = 0;
+// the enemy being attacked, and its monster
+static int target = 0;
+static const Monster *current_battle;
+// Picks monsters for encounters, built from the weights of the player's tier
+static AliasTable encounter_table;
+static int encounter_tier = -1;
+// Presses so far this battle. Entries are allocated one by one after the
+// enemies, so nothing else may come from the arena during a battle.
+static DamageEntry *damage_log = NULL;
+static int damage_log_count = 0;
 // This holds the current player health
 // TODO this will change when stats are implemented
 static int current_player_health;
 static char player_health_str[3];
+static char odds_str[24];
+static char enemy_name_str[24];
+static char journey_str[64];
 // This int represents what sort of mode the game is in right now
 // This will be overwritten at launch
 static int state = WELCOME;
 
-static AppTimer *travel_timer;
-static AccelData accel_prev;
-static AccelData accel_current;
-// TODO pull this out of persistent storage
+// Steps taken since the last encounter, and since they were last checkpointed
 static int movement_total = 0;
+static int steps_unsaved = 0;
+
+// Step detector state. The baseline is a running average of the
+// acceleration magnitude in 1/16 milli-g, subtracting it removes gravity.
+static int32_t accel_baseline = 0;
+static bool step_armed = true;
+static int samples_since_step = 0;
+
+// Fonts and bitmaps stay loaded while referenced, and unreferenced ones
+// stay around until the cache goes over budget
+typedef struct {
+    uint32_t resource_id;
+    void *resource;             // GFont or GBitmap*, NULL for a free slot
+    bool is_font;
+    uint8_t refs;
+    uint16_t bytes;             // counted against RESOURCE_CACHE_BUDGET, 0 for fonts
+    uint16_t heap;              // heap the load actually took
+    uint32_t last_used;
+} CachedResource;
+
+static CachedResource resource_cache[RESOURCE_CACHE_SIZE];
+static uint32_t resource_cache_clock = 0;
+static uint32_t resource_cache_hits = 0;
+static uint32_t resource_cache_misses = 0;
+static uint32_t resource_cache_bytes = 0;
+static uint32_t resource_cache_heap = 0;
+
+// Exact odds against the current monster when always using the best weapon.
+// Indexed by [rolls the monster still gets][hits the player can still take].
+// Taking more hits than there are rolls is always a win, so the last column
+// stands for every such case. Both only depend on the monster's hit chance
+// and are rebuilt when that changes.
+static uint16_t odds_win[MAX_MONSTER_HEALTH][MAX_MONSTER_HEALTH + 1];
+static uint16_t odds_hits[MAX_MONSTER_HEALTH][MAX_MONSTER_HEALTH + 1];
+static int odds_hit_chance = -1;
+
+// Width of the monster health bar currently on screen, which trails the
+// real health while the drain animation runs
+static int bar_width_shown = 0;
+// the sprite the battle scene's bitmap layer currently points at
+static const GBitmap *shown_sprite = NULL;
+static int bar_step = 1;
+static AppTimer *bar_timer = NULL;
+
+// Heap accounting per scene, indexed by state. Resources are charged to
+// the cache rather than to the scene that asked for them.
+typedef struct {
+    size_t high_water;          // highest heap use while the scene showed
+    int built;                  // bytes its retained layers take
+    int held;                   // bytes its build, load and unload calls still hold
+} SceneHeap;
+
+static SceneHeap scene_heap[STATE_COUNT];
+// Heap use outside the cache and the retained scenes when the welcome
+// screen last showed after launching finished, -1 before that, and the
+// states visited since
+static int cycle_heap_start = -1;
+static uint8_t cycle_states = 0;
+
+// Sprite resource held for the upcoming battle, 0 when none
+static uint32_t preloaded_sprite = 0;
+static AppTimer *preload_timer = NULL;
+// now_ms() of the last encounter, cleared once the battle screen has drawn
+static uint32_t encounter_started = 0;
+// now_ms() when the app was launched, for timing the first frame
+static uint32_t launch_started = 0;
+static bool launch_drawn = false;
+static bool launch_finished = false;
+
+// Steps are being counted, on the travel screen or the journey opened from it
+static bool travel_walking = false;
+static bool journey_open = false;
+
+// Idle back-off state
+static bool travel_idle = false;
+static int idle_batches = 0;
+static uint32_t probe_interval = TRAVEL_PROBE_MIN;
+static AppTimer *probe_timer = NULL;
+static AccelData probe_last;
+
+// Power cost counters for the current stretch of travel
+static time_t travel_started;
+// journey_log.total_steps when the travel screen was opened
+static uint32_t travel_start_steps;
+static time_t idle_started;
+static int idle_seconds = 0;
+static uint32_t accel_wakeups = 0;
+static uint32_t accel_samples = 0;
+
+// xorshift32 state, never zero. Saved with the game so rolls can be replayed.
+static uint32_t rng_state;
 
 void state_transition(int new_state);
+void save_mark_dirty(uint8_t fields);
+
+// What each state does, indexed by state. Presses a state ignores are NULL.
+typedef struct {
+    void (*load)(Window *window);
+    void (*unload)(Window *window);
+    void (*on_up)(void);
+    void (*on_select)(void);
+    void (*on_down)(void);
+    void (*on_up_long)(void);
+    void (*on_down_long)(void);
+} Scene;
+
+// filled in below the scenes
+static const Scene scenes[STATE_COUNT];
+
+void rng_seed(uint32_t seed) {
+    rng_state = seed != 0 ? seed : 0x2545f491;
+}
+
+uint32_t xorshift() {
+    save_mark_dirty(SAVE_DIRTY_RNG);
+    return combat_xorshift(&rng_state);
+}
+
+// Uniform roll in [0, range)
+int rng_below(int range) {
+    return combat_scale(xorshift(), range);
+}
+
+// Uniform roll in [0, 1000), to compare against per-mille chances
+int rng() {
+    return rng_below(1000);
+}
+
+// Queues an event for the phone, unless it is only being replayed
+static void report(TelemetryType type, uint8_t arg, int value) {
+    if (!journal_replaying) {
+        telemetry_record(type, arg, value < UINT16_MAX ? value : UINT16_MAX);
+    }
+}
+
+static void journal_load() {
+    if (journal_loaded) {
+        return;
+    }
+    journal_loaded = true;
+    instrument_persist_read(sizeof(journal));
+    if (persist_read_data(JOURNAL_KEY, &journal, sizeof(journal)) != (int) sizeof(journal) ||
+            journal.head >= JOURNAL_LENGTH || journal.count > JOURNAL_LENGTH) {
+        memset(&journal, 0, sizeof(journal));
+    }
+}
+
+void journal_record(uint8_t type, uint8_t arg) {
+    if (journal_replaying) {
+        return;
+    }
+    journal_load();
+    JournalEntry *entry = &journal.entries[journal.head];
+    entry->type = type;
+    entry->arg = arg;
+    entry->rng = rng_state;
+    journal.head = (journal.head + 1) % JOURNAL_LENGTH;
+    if (journal.count < JOURNAL_LENGTH) {
+        journal.count++;
+    }
+    save_mark_dirty(SAVE_DIRTY_JOURNAL);
+}
+
+static void journey_log_push(int steps, int hours) {
+    while (hours > 0) {
+        JourneyRun *newest = &journey_log.runs[(journey_log.head + JOURNEY_RUNS - 1) % JOURNEY_RUNS];
+        if (journey_log.count > 0 && newest->steps == steps && newest->hours < UINT8_MAX) {
+            int added = hours < UINT8_MAX - newest->hours ? hours : UINT8_MAX - newest->hours;
+            newest->hours += added;
+            hours -= added;
+            continue;
+        }
+        journey_log.runs[journey_log.head] = (JourneyRun) { .steps = steps, .hours = 0 };
+        journey_log.head = (journey_log.head + 1) % JOURNEY_RUNS;
+        if (journey_log.count < JOURNEY_RUNS) {
+            journey_log.count++;
+        }
+    }
+}
+
+// Closes the hour being counted once the clock has moved past it, filling
+// any hours the app wasn't running with zero steps
+static void journey_log_roll() {
+    uint32_t hour = time(NULL) / 3600;
+    if (journey_log.hour == 0 || hour < journey_log.hour) {
+        journey_log.hour = hour;
+        return;
+    }
+    if (hour == journey_log.hour) {
+        return;
+    }
+    int steps = (journey_log.hour_steps + JOURNEY_STEP_UNIT / 2) / JOURNEY_STEP_UNIT;
+    journey_log_push(steps < UINT8_MAX ? steps : UINT8_MAX, 1);
+    // more than the whole log can hold would only push out the same zeroes
+    uint32_t idle = hour - journey_log.hour - 1;
+    journey_log_push(0, idle < JOURNEY_RUNS * UINT8_MAX ? idle : JOURNEY_RUNS * UINT8_MAX);
+    journey_log.hour = hour;
+    journey_log.hour_steps = 0;
+    save_mark_dirty(SAVE_DIRTY_JOURNEY);
+}
+
+static void journey_log_load() {
+    if (journey_log_loaded) {
+        return;
+    }
+    journey_log_loaded = true;
+    instrument_persist_read(sizeof(journey_log));
+    if (persist_read_data(JOURNEY_KEY, &journey_log, sizeof(journey_log)) != (int) sizeof(journey_log) ||
+            journey_log.head >= JOURNEY_RUNS || journey_log.count > JOURNEY_RUNS) {
+        memset(&journey_log, 0, sizeof(journey_log));
+    }
+    journey_log_roll();
+}
+
+// Counts steps towards the journey history and the next checkpoint
+static void journey_log_add(int steps) {
+    journey_log_load();
+    journey_log_roll();
+    journey_log.hour_steps = journey_log.hour_steps + steps < UINT16_MAX ? journey_log.hour_steps + steps : UINT16_MAX;
+    journey_log.total_steps += steps;
+    steps_unsaved += steps;
+    if (steps_unsaved >= TRAVEL_CHECKPOINT_STEPS) {
+        save_mark_dirty(SAVE_DIRTY_TRAVEL | SAVE_DIRTY_JOURNEY);
+        steps_unsaved = 0;
+    }
+}
+
+// Milliseconds since the epoch, wrapping every ~49 days
+uint32_t now_ms() {
+    time_t seconds;
+    uint16_t millis;
+    time_ms(&seconds, &millis);
+    return seconds * 1000 + millis;
+}
+
+// Integer square root, one result bit per iteration
+uint32_t isqrt(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1 << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+static void resource_cache_free(CachedResource *entry) {
+    if (entry->is_font) {
+        fonts_unload_custom_font(entry->resource);
+    } else {
+        gbitmap_destroy(entry->resource);
+    }
+    resource_cache_bytes -= entry->bytes;
+    resource_cache_heap -= entry->heap;
+    entry->resource = NULL;
+}
+
+// Drops the least recently used unreferenced bitmaps until under budget
+static void resource_cache_evict() {
+    while (resource_cache_bytes > RESOURCE_CACHE_BUDGET) {
+        CachedResource *oldest = NULL;
+        for (int i = 0; i < RESOURCE_CACHE_SIZE; i++) {
+            CachedResource *entry = &resource_cache[i];
+            if (entry->resource != NULL && !entry->is_font && entry->refs == 0 &&
+                    (oldest == NULL || entry->last_used < oldest->last_used)) {
+                oldest = entry;
+            }
+        }
+        if (oldest == NULL) {
+            return;
+        }
+        resource_cache_free(oldest);
+    }
+}
+
+static CachedResource* resource_cache_acquire(uint32_t resource_id, bool is_font) {
+    CachedResource *slot = NULL;
+    for (int i = 0; i < RESOURCE_CACHE_SIZE; i++) {
+        CachedResource *entry = &resource_cache[i];
+        if (entry->resource != NULL && entry->resource_id == resource_id) {
+            resource_cache_hits++;
+            entry->refs++;
+            entry->last_used = ++resource_cache_clock;
+            return entry;
+        }
+        if (entry->resource == NULL && slot == NULL) {
+            slot = entry;
+        }
+    }
+    resource_cache_misses++;
+    if (slot == NULL) {
+        // every slot is taken, make room by evicting everything unused
+        for (int i = 0; i < RESOURCE_CACHE_SIZE; i++) {
+            CachedResource *entry = &resource_cache[i];
+            if (!entry->is_font && entry->refs == 0) {
+                resource_cache_free(entry);
+                slot = entry;
+            }
+        }
+    }
+    if (slot == NULL) {
+        APP_LOG(APP_LOG_LEVEL_ERROR, "Resource cache is full.");
+        return NULL;
+    }
+
+    size_t heap_before = heap_bytes_used();
+    slot->resource_id = resource_id;
+    slot->is_font = is_font;
+    slot->refs = 1;
+    slot->last_used = ++resource_cache_clock;
+    if (is_font) {
+        slot->resource = fonts_load_custom_font(resource_get_handle(resource_id));
+        // fonts are never evicted, so they don't use up the bitmap budget
+        slot->bytes = 0;
+    } else {
+#ifdef INSTRUMENT
+        uint32_t started = now_ms();
+#endif
+        GBitmap *bitmap = gbitmap_create_with_resource(resource_id);
+        instrument_bitmap_load();
+#ifdef INSTRUMENT
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Loaded bitmap %d in %dms, heap now %d bytes.",
+                (int) resource_id, (int) (now_ms() - started), (int) heap_bytes_used());
+#endif
+        slot->resource = bitmap;
+        slot->bytes = bitmap->row_size_bytes * bitmap->bounds.size.h;
+    }
+    slot->heap = heap_bytes_used() - heap_before;
+    resource_cache_bytes += slot->bytes;
+    resource_cache_heap += slot->heap;
+    resource_cache_evict();
+    return slot;
+}
+
+GFont resource_cache_font(uint32_t resource_id) {
+    CachedResource *entry = resource_cache_acquire(resource_id, true);
+    return entry != NULL ? entry->resource : fonts_get_system_font(FONT_KEY_GOTHIC_18);
+}
+
+GBitmap* resource_cache_bitmap(uint32_t resource_id) {
+    CachedResource *entry = resource_cache_acquire(resource_id, false);
+    return entry != NULL ? entry->resource : NULL;
+}
+
+// Gives back a reference taken by resource_cache_font/resource_cache_bitmap
+void resource_cache_release(uint32_t resource_id) {
+    for (int i = 0; i < RESOURCE_CACHE_SIZE; i++) {
+        CachedResource *entry = &resource_cache[i];
+        if (entry->resource != NULL && entry->resource_id == resource_id && entry->refs > 0) {
+            entry->refs--;
+            break;
+        }
+    }
+    resource_cache_evict();
+}
+
+static void resource_cache_clear() {
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Resource cache: %d hits, %d misses, %d bytes held.",
+            (int) resource_cache_hits, (int) resource_cache_misses, (int) resource_cache_bytes);
+    for (int i = 0; i < RESOURCE_CACHE_SIZE; i++) {
+        if (resource_cache[i].resource != NULL) {
+            resource_cache_free(&resource_cache[i]);
+        }
+    }
+}
+
+// Writes the save blob if anything changed since the last write
+void save_flush() {
+    if (save_timer != NULL) {
+        app_timer_cancel(save_timer);
+        save_timer = NULL;
+    }
+    if (journal_replayed) {
+        save_dirty = 0;
+        return;
+    }
+    if (save_dirty & SAVE_DIRTY_JOURNAL) {
+        persist_write_data(JOURNAL_KEY, &journal, sizeof(journal));
+        instrument_persist_write(sizeof(journal));
+        battle_flash_writes++;
+        save_dirty &= ~SAVE_DIRTY_JOURNAL;
+    }
+    if (save_dirty & SAVE_DIRTY_JOURNEY) {
+        persist_write_data(JOURNEY_KEY, &journey_log, sizeof(journey_log));
+        instrument_persist_write(sizeof(journey_log));
+        battle_flash_writes++;
+        save_dirty &= ~SAVE_DIRTY_JOURNEY;
+    }
+    if (save_dirty == 0) {
+        return;
+    }
+    SaveGame save = {
+        .version = SAVE_VERSION,
+        .state = state,
+        .monster_index = -1,
+        .player_max_health = player_max_health,
+        .player_current_health = current_player_health,
+        .rng_state = rng_state,
+        .enemy_count = enemy_count,
+        .target = target,
+        .movement_total = movement_total,
+    };
+    for (int weapon = 0; weapon < WEAPON_COUNT && weapon < SAVE_WEAPONS; weapon++) {
+        save.player_damage[weapon] = player_damage[weapon];
+    }
+    for (int i = 0; i < enemy_count; i++) {
+        save.enemy_monsters[i] = enemies[i].monster;
+        save.enemy_health[i] = enemies[i].health;
+    }
+    persist_write_data(SAVE_KEY, &save, sizeof(save));
+    instrument_persist_write(sizeof(save));
+    instrument_trace(TRACE_FLUSH, save_dirty);
+    battle_flash_writes++;
+    save_dirty = 0;
+}
+
+static void save_timer_callback(void *context) {
+    save_timer = NULL;
+    save_flush();
+}
+
+// Records that some fields changed; they reach flash on the next flush
+void save_mark_dirty(uint8_t fields) {
+    save_dirty |= fields;
+    if (save_timer == NULL) {
+        save_timer = app_timer_register(SAVE_FLUSH_DELAY, save_timer_callback, NULL);
+    }
+}
+
+static void* battle_arena_alloc(size_t bytes) {
+    bytes = (bytes + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    if (battle_arena_used + bytes > sizeof(battle_arena)) {
+        return NULL;
+    }
+    void *block = (uint8_t*) battle_arena + battle_arena_used;
+    battle_arena_used += bytes;
+    return block;
+}
+
+// Drops the encounter and everything else allocated for it
+static void battle_arena_reset() {
+    battle_arena_used = 0;
+    enemies = NULL;
+    enemy_count = 0;
+    target = 0;
+    damage_log = NULL;
+    damage_log_count = 0;
+}
+
+// Makes room for a new encounter of count enemies, which the caller fills in
+static Enemy* encounter_start(int count) {
+    battle_arena_reset();
+    enemies = battle_arena_alloc(sizeof(Enemy) * count);
+    enemy_count = enemies != NULL ? count : 0;
+    return enemies;
+}
+
+static int encounter_alive() {
+    int alive = 0;
+    for (int i = 0; i < enemy_count; i++) {
+        alive += enemies[i].health > 0;
+    }
+    return alive;
+}
+
+// Moves the target by step through the living enemies, wrapping around.
+// Returns false once none are left.
+static bool encounter_next_target(int step) {
+    for (int i = 1; i <= enemy_count; i++) {
+        int candidate = (target + step * i + enemy_count * MAX_ENEMIES) % enemy_count;
+        if (enemies[candidate].health > 0) {
+            target = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Stat points gained since the start of the run
+static int player_level() {
+    int damage = 0;
+    for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+        damage += player_damage[weapon];
+    }
+    return combat_level(player_max_health, damage, WEAPON_COUNT);
+}
 
-float rng() {
-    return (float) rand() / (float) RAND_MAX;
+// Rebuilds the encounter table when the player's level has moved into
+// another tier, so it only happens a few times per run
+static void encounter_table_update() {
+    int level = player_level();
+    int tier = 0;
+    while (tier + 1 < ENCOUNTER_TIERS && level >= encounter_tier_levels[tier + 1]) {
+        tier++;
+    }
+    if (tier != encounter_tier) {
+        alias_build(&encounter_table, encounter_weights[tier], MONSTER_COUNT);
+        encounter_tier = tier;
+    }
 }
 
-int custom_abs(int value) {
-    uint32_t temp = value >> 31;     // make a mask of the sign bit
-    value ^= temp;                   // toggle the bits if value is negative
-    value += temp & 1;               // add one if value was negative
-    return value;
+void random_encounter() {
+    int count = 1 + rng_below(MAX_ENEMIES);
+    encounter_start(count);
+    for (int i = 0; i < enemy_count; i++) {
+        enemies[i].monster = alias_sample(&encounter_table, xorshift());
+        enemies[i].health = monster_index[enemies[i].monster].health;
+    }
+    save_mark_dirty(SAVE_DIRTY_BATTLE);
+}
+
+static void damage_log_add(int enemy, int weapon, int dealt, int taken) {
+    DamageEntry *entry = battle_arena_alloc(sizeof(DamageEntry));
+    // once the arena is full the rest of the battle goes unlogged
+    if (entry == NULL) {
+        return;
+    }
+    if (damage_log == NULL) {
+        damage_log = entry;
+    }
+    *entry = (DamageEntry) { .enemy = enemy, .weapon = weapon, .dealt = dealt, .taken = taken };
+    damage_log_count++;
+}
+
+// Damage each weapon does to each enemy of the encounter, indexed like
+// enemies[] and weapon_icons[]. Rebuilt when a battle starts and when a
+// stat goes up, so a press is a single lookup.
+static int16_t damage_matrix[MAX_ENEMIES][WEAPON_COUNT];
+
+static void damage_matrix_update() {
+    for (int i = 0; i < enemy_count; i++) {
+        const Monster *monster = &monster_index[enemies[i].monster];
+        for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+            damage_matrix[i][weapon] = combat_damage(player_damage[weapon], monster, weapon_icons[weapon].type);
+        }
+    }
 }
 
-Monster* random_encounter() {
-    int index = rand() % 11;
-    persist_write_int(MONSTER_INDEX_KEY, index);
-    persist_write_int(MONSTER_CURRENT_HEALTH_KEY, monster_index[index]->health);
-    return monster_index[index];
+// The weapon in weapon_icons that does a damage type, -1 for none
+static int weapon_slot(int type) {
+    for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+        if (weapon_icons[weapon].type == type) {
+            return weapon;
+        }
+    }
+    return -1;
 }
 
 void increase_stats(int attribute) {
+    int weapon = weapon_slot(attribute);
+    int value = 0;
     if (attribute == HEALTH_STAT) {
         player_max_health += 1;
         current_player_health += 1;
-        persist_write_int(PLAYER_MAX_HEALTH_KEY, player_max_health);
-        persist_write_int(PLAYER_CURRENT_HEALTH_KEY, current_player_health);
-    } else if (attribute == SWORD_DAMAGE) {
-        player_sword_damage += 1;
-        persist_write_int(PLAYER_SWORD_DAMAGE_KEY, player_sword_damage); 
-    } else if (attribute == MAGIC_DAMAGE) {
-        player_magic_damage += 1;
-        persist_write_int(PLAYER_MAGIC_DAMAGE_KEY, player_magic_damage); 
-    } else if (attribute == BOW_DAMAGE) {
-        player_bow_damage += 1;
-        persist_write_int(PLAYER_BOW_DAMAGE_KEY, player_bow_damage); 
+        value = player_max_health;
+        save_mark_dirty(SAVE_DIRTY_STATS | SAVE_DIRTY_PLAYER_HEALTH);
+    } else if (weapon >= 0) {
+        player_damage[weapon] += 1;
+        value = player_damage[weapon];
+        save_mark_dirty(SAVE_DIRTY_STATS);
     }
+    report(TELEMETRY_STAT_GAIN, attribute, value);
+    encounter_table_update();
+    damage_matrix_update();
 }
 
+void stats_reset() {
+    player_max_health = START_HEALTH;
+    current_player_health = player_max_health;
+    for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+        player_damage[weapon] = START_DAMAGE;
+    }
+    encounter_table_update();
+    // the arena itself is reset when the battle scene unloads
+    enemy_count = 0;
+    save_mark_dirty(SAVE_DIRTY_STATS | SAVE_DIRTY_PLAYER_HEALTH | SAVE_DIRTY_BATTLE);
+}
+
+// this is so that when we restart, player variables are set back to the baseline
 void clear_stats() {
-    persist_delete(PLAYER_MAX_HEALTH_KEY);
-    persist_delete(PLAYER_CURRENT_HEALTH_KEY);
-    persist_delete(PLAYER_SWORD_DAMAGE_KEY);
-    persist_delete(PLAYER_MAGIC_DAMAGE_KEY);
-    persist_delete(PLAYER_BOW_DAMAGE_KEY);
-    persist_delete(MONSTER_INDEX_KEY);
-    persist_delete(MONSTER_CURRENT_HEALTH_KEY);
-    persist_delete(STATE_KEY);
+    stats_reset();
 }
 
-void attack(int type) {
-    int damage = 0;
-    if (type == SWORD_DAMAGE) {
-        damage = player_sword_damage;
-    } else if (type == MAGIC_DAMAGE) {
-        damage = player_magic_damage;
-    } else if (type == BOW_DAMAGE) {
-        damage = player_bow_damage;
-    }
-    if ((current_battle->resistances & type) == 0) {
-        current_monster_health -= damage;
-    } else {
-        current_monster_health -= (int)((float) damage / 5.0);
+static int bar_target_width() {
+    int health = enemies[target].health > 0 ? enemies[target].health : 0;
+    return health * HEALTH_BAR_WIDTH / current_battle->health;
+}
+
+static void bar_frame(void *context) {
+    int target = bar_target_width();
+    bar_width_shown = bar_width_shown - bar_step > target ? bar_width_shown - bar_step : target;
+    layer_mark_dirty(monster_health_layer);
+    // the timer only runs while the bar is still moving
+    bar_timer = bar_width_shown != target ? app_timer_register(BAR_FRAME_INTERVAL, bar_frame, NULL) : NULL;
+}
+
+// Starts draining the bar towards the current health
+static void bar_animate() {
+    int distance = bar_width_shown - bar_target_width();
+    if (distance <= 0) {
+        bar_width_shown = bar_target_width();
+        layer_mark_dirty(monster_health_layer);
+        return;
     }
-    if (current_monster_health <= 0) {
-        increase_stats(current_battle->stat_boost);
-        persist_delete(MONSTER_CURRENT_HEALTH_KEY);
-        persist_delete(MONSTER_INDEX_KEY);
-        state_transition(TRAVEL);
-    } else {
-        persist_write_int(MONSTER_CURRENT_HEALTH_KEY, current_monster_health);
-        if (rng() < current_battle->hit_chance) {
-            current_player_health -= current_battle->damage;
-            if (current_player_health <= 0) {
-                clear_stats();
-                state_transition(DEATH);
-                return;
+    bar_step = (distance + BAR_MAX_FRAMES - 1) / BAR_MAX_FRAMES;
+    if (bar_timer == NULL) {
+        bar_timer = app_timer_register(BAR_FRAME_INTERVAL, bar_frame, NULL);
+    }
+}
+
+static void bar_stop() {
+    if (bar_timer != NULL) {
+        app_timer_cancel(bar_timer);
+        bar_timer = NULL;
+    }
+    bar_width_shown = bar_target_width();
+}
+
+// The most damage any weapon does to a monster, given weapon stats indexed
+// like weapon_icons
+static int best_damage(const Monster *monster, const int stats[WEAPON_COUNT]) {
+    int best = 0;
+    for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+        int damage = combat_damage(stats[weapon], monster, weapon_icons[weapon].type);
+        if (damage > best) {
+            best = damage;
+        }
+    }
+    return best;
+}
+
+static void odds_build(int hit_chance) {
+    uint32_t hit = hit_chance * ODDS_ONE / 1000;
+    uint32_t miss = ODDS_ONE - hit;
+    for (int hits = 0; hits <= MAX_MONSTER_HEALTH; hits++) {
+        odds_win[0][hits] = hits > 0 ? ODDS_ONE : 0;
+        odds_hits[0][hits] = 0;
+    }
+    for (int rolls = 1; rolls < MAX_MONSTER_HEALTH; rolls++) {
+        odds_win[rolls][0] = 0;
+        odds_hits[rolls][0] = 0;
+        for (int hits = 1; hits <= MAX_MONSTER_HEALTH; hits++) {
+            odds_win[rolls][hits] = (miss * odds_win[rolls - 1][hits] +
+                                     hit * odds_win[rolls - 1][hits - 1]) / ODDS_ONE;
+            odds_hits[rolls][hits] = (miss * odds_hits[rolls - 1][hits] +
+                                      hit * (ODDS_HIT + odds_hits[rolls - 1][hits - 1])) / ODDS_ONE;
+        }
+    }
+    odds_hit_chance = hit_chance;
+}
+
+// Looks up the odds when the target is the last enemy standing
+static void odds_single(int *win, int *lost) {
+    if (current_battle->hit_chance != odds_hit_chance) {
+        odds_build(current_battle->hit_chance);
+    }
+    int best = 0;
+    for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+        best = damage_matrix[target][weapon] > best ? damage_matrix[target][weapon] : best;
+    }
+    *win = 0;
+    *lost = current_battle->hit_chance > 0 ? current_player_health : 0;
+    if (best > 0) {
+        // the killing blow ends the fight before the monster can answer
+        int rolls = (enemies[target].health + best - 1) / best - 1;
+        int hits_to_die = (current_player_health + current_battle->damage - 1) / current_battle->damage;
+        int hits = hits_to_die < rolls + 1 ? hits_to_die : rolls + 1;
+        *win = odds_win[rolls][hits];
+        // health lost is capped at what the player has left
+        int overkill = hits_to_die * current_battle->damage - current_player_health;
+        int lost_q12 = current_battle->damage * odds_hits[rolls][hits] -
+                       overkill * (ODDS_ONE - *win) * ODDS_HIT / ODDS_ONE;
+        *lost = (lost_q12 + ODDS_HIT / 2) / ODDS_HIT;
+    }
+}
+
+// Works out the odds against several enemies by stepping the chances of
+// having taken each amount of damage through every press, fighting them in
+// the order the target moves through them with the best weapon each time
+static void odds_group(int *win, int *lost) {
+    static uint32_t taken[ODDS_MAX_TAKEN];
+    int stats[WEAPON_COUNT];
+    int health[MAX_ENEMIES];
+    int limit = current_player_health;
+    uint32_t dead = 0;
+    for (int i = 0; i < enemy_count; i++) {
+        health[i] = enemies[i].health;
+    }
+    memcpy(stats, player_damage, sizeof(stats));
+    memset(taken, 0, sizeof(taken));
+    taken[0] = ODDS_ONE;
+    *win = 0;
+    *lost = current_player_health;
+
+    for (int fought = 0; fought < enemy_count; fought++) {
+        int current = (target + fought) % enemy_count;
+        const Monster *monster = &monster_index[enemies[current].monster];
+        if (health[current] <= 0) {
+            continue;
+        }
+        int best = best_damage(monster, stats);
+        if (best == 0) {
+            return;
+        }
+        while (health[current] > 0) {
+            health[current] -= best;
+            if (health[current] <= 0 && monster->stat_boost == HEALTH_STAT) {
+                limit++;
+            } else if (health[current] <= 0 && weapon_slot(monster->stat_boost) >= 0) {
+                stats[weapon_slot(monster->stat_boost)]++;
+            }
+            // then every enemy still standing gets its roll
+            for (int i = 0; i < enemy_count; i++) {
+                if (health[i] <= 0) {
+                    continue;
+                }
+                const Monster *attacker = &monster_index[enemies[i].monster];
+                uint32_t hit = attacker->hit_chance * ODDS_ONE / 1000;
+                int top = limit < ODDS_MAX_TAKEN ? limit : ODDS_MAX_TAKEN;
+                for (int t = top - 1; t >= 0; t--) {
+                    uint32_t hurt = taken[t] * hit / ODDS_ONE;
+                    int after = t + attacker->damage;
+                    taken[t] -= hurt;
+                    if (after >= limit) {
+                        dead += hurt;
+                    } else {
+                        taken[after < ODDS_MAX_TAKEN ? after : ODDS_MAX_TAKEN - 1] += hurt;
+                    }
+                }
             }
-            vibes_short_pulse();
-            persist_write_int(PLAYER_CURRENT_HEALTH_KEY, current_player_health);
-            snprintf(player_health_str, 3, "%d", current_player_health);
-            text_layer_set_text(player_health, player_health_str);
         }
     }
+    int64_t lost_q15 = (int64_t) dead * current_player_health;
+    for (int t = 0; t < ODDS_MAX_TAKEN; t++) {
+        *win += taken[t];
+        lost_q15 += (int64_t) taken[t] * t;
+    }
+    *lost = (lost_q15 + ODDS_ONE / 2) / ODDS_ONE;
+}
+
+// Works out the chance of winning and expected health lost from here
+static void odds_update() {
+    int win;
+    int lost;
+    if (encounter_alive() > 1) {
+        odds_group(&win, &lost);
+    } else {
+        odds_single(&win, &lost);
+    }
+    snprintf(odds_str, sizeof(odds_str), "Win %d%%, -%d HP", (win * 100 + ODDS_ONE / 2) / ODDS_ONE, lost);
+    layer_mark_dirty(text_layer_get_layer(odds_text));
+}
+
+// Points the name and sprite layers at the target, numbering it when
+// there is more than one enemy
+static void battle_show_target() {
+    if (enemy_count > 1) {
+        snprintf(enemy_name_str, sizeof(enemy_name_str), "%s %d/%d", current_battle->name,
+                 target + 1, enemy_count);
+    } else {
+        snprintf(enemy_name_str, sizeof(enemy_name_str), "%s", current_battle->name);
+    }
+    text_layer_set_text(enemy_name, enemy_name_str);
+    // the retained layers may still show the last sprite, only swap it when it differs. A
+    // released sprite can be evicted, so the same monster may come back as a new bitmap.
+    if (monster_sprite != shown_sprite) {
+        shown_sprite = monster_sprite;
+        bitmap_layer_set_bitmap(monster_layer, monster_sprite);
+    }
+}
+
+// Moves the battle screen's sprite reference and health bar to the new target
+static void battle_retarget() {
+    const Monster *previous = current_battle;
+    current_battle = &monster_index[enemies[target].monster];
+    // enemies of the same kind share one sprite and its reference
+    if (current_battle->sprite != previous->sprite) {
+        resource_cache_release(previous->sprite);
+        monster_sprite = resource_cache_bitmap(current_battle->sprite);
+    }
+    battle_show_target();
+    bar_stop();
     layer_mark_dirty(monster_health_layer);
 }
 
-static void select_click_handler(ClickRecognizerRef recognizer, void *context) {
-    if (state == BATTLE) {
-        attack(MAGIC_DAMAGE);
-    } else if (state == DEATH) {
-        state_transition(WELCOME);
-    } else if (state == WELCOME) {
-        state_transition(TRAVEL);
+// Repaints only the parts of the battle screen that changed
+static void battle_invalidate(uint8_t changed) {
+    if (changed & BATTLE_DIRTY_TARGET) {
+        battle_retarget();
     }
+    if (changed != 0) {
+        odds_update();
+    }
+    if (changed & BATTLE_DIRTY_BAR) {
+        bar_animate();
+    }
+    if (changed & BATTLE_DIRTY_PLAYER_HEALTH) {
+        snprintf(player_health_str, 3, "%d", current_player_health);
+        layer_mark_dirty(text_layer_get_layer(player_health));
+    }
+}
+
+// Hits the target with one of weapon_icons
+void attack(int weapon) {
+    PROBE_BEGIN();
+    int attacked = target;
+    int dealt = damage_matrix[target][weapon];
+    int taken = 0;
+    uint8_t changed = dealt != 0 ? BATTLE_DIRTY_BAR : 0;
+    // health is an int8_t, a big hit must stop at 0 rather than wrap back around
+    enemies[target].health = enemies[target].health > dealt ? enemies[target].health - dealt : 0;
+    if (dealt != 0) {
+        save_mark_dirty(SAVE_DIRTY_BATTLE);
+    }
+    if (enemies[target].health <= 0) {
+        increase_stats(current_battle->stat_boost);
+        if (!encounter_next_target(1)) {
+            damage_log_add(attacked, weapon, dealt, 0);
+            report(TELEMETRY_BATTLE_WON, enemy_count, damage_log_count);
+            enemy_count = 0;
+            state_transition(TRAVEL);
+            PROBE_END(PROBE_ATTACK);
+            return;
+        }
+        changed |= BATTLE_DIRTY_TARGET;
+    }
+    // every enemy still standing answers, in order
+    for (int i = 0; i < enemy_count; i++) {
+        const Monster *attacker = &monster_index[enemies[i].monster];
+        if (enemies[i].health <= 0 || !combat_monster_hits(attacker, rng())) {
+            continue;
+        }
+        current_player_health -= attacker->damage;
+        taken += attacker->damage;
+        if (current_player_health <= 0) {
+            damage_log_add(attacked, weapon, dealt, taken);
+            report(TELEMETRY_DIED, enemies[i].monster, player_level());
+            clear_stats();
+            state_transition(DEATH);
+            PROBE_END(PROBE_ATTACK);
+            return;
+        }
+    }
+    if (taken != 0) {
+        vibes_short_pulse();
+        save_mark_dirty(SAVE_DIRTY_PLAYER_HEALTH);
+        changed |= BATTLE_DIRTY_PLAYER_HEALTH;
+    }
+    damage_log_add(attacked, weapon, dealt, taken);
+    battle_invalidate(changed);
+    PROBE_END(PROBE_ATTACK);
+}
 
+static void select_click_handler(ClickRecognizerRef recognizer, void *context) {
+    journal_record(JOURNAL_BUTTON, BUTTON_ID_SELECT);
+    instrument_trace(TRACE_BUTTON, BUTTON_ID_SELECT);
+    if (scenes[state].on_select != NULL) {
+        scenes[state].on_select();
+    }
 }
 
 static void up_click_handler(ClickRecognizerRef recognizer, void *context) {
-    if (state == BATTLE) {
-        attack(SWORD_DAMAGE);
-    } else if (state == DEATH) {
-        state_transition(WELCOME);
-    } else if (state == WELCOME) {
-        state_transition(TRAVEL);
+    journal_record(JOURNAL_BUTTON, BUTTON_ID_UP);
+    instrument_trace(TRACE_BUTTON, BUTTON_ID_UP);
+    if (scenes[state].on_up != NULL) {
+        scenes[state].on_up();
     }
+}
 
+static void down_click_handler(ClickRecognizerRef recognizer, void *context) {
+    journal_record(JOURNAL_BUTTON, BUTTON_ID_DOWN);
+    instrument_trace(TRACE_BUTTON, BUTTON_ID_DOWN);
+    if (scenes[state].on_down != NULL) {
+        scenes[state].on_down();
+    }
+}
 
+// Moves the target to the previous (step -1) or next (step 1) living enemy
+static void battle_change_target(int step) {
+    int previous = target;
+    if (encounter_next_target(step) && target != previous) {
+        save_mark_dirty(SAVE_DIRTY_BATTLE);
+        battle_invalidate(BATTLE_DIRTY_TARGET);
+    }
 }
 
-static void down_click_handler(ClickRecognizerRef recognizer, void *context) {
-    if (state == BATTLE) {
-        attack(BOW_DAMAGE);
-    } else if (state == DEATH) {
-        state_transition(WELCOME);
-    } else if (state == WELCOME) {
-        state_transition(TRAVEL);
+static void up_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+    journal_record(JOURNAL_LONG_BUTTON, BUTTON_ID_UP);
+    instrument_trace(TRACE_BUTTON, BUTTON_ID_UP);
+    if (scenes[state].on_up_long != NULL) {
+        scenes[state].on_up_long();
     }
+}
 
+static void down_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+    journal_record(JOURNAL_LONG_BUTTON, BUTTON_ID_DOWN);
+    instrument_trace(TRACE_BUTTON, BUTTON_ID_DOWN);
+    if (scenes[state].on_down_long != NULL) {
+        scenes[state].on_down_long();
+    }
+}
 
+#ifdef INSTRUMENT
+// Loads every monster sprite once, outside the cache, and logs its cost
+static void sprite_report() {
+    for (int i = 0; i < MONSTER_COUNT; i++) {
+        size_t heap_before = heap_bytes_used();
+        uint32_t started = now_ms();
+        GBitmap *sprite = gbitmap_create_with_resource(monster_index[i].sprite);
+        uint32_t elapsed = now_ms() - started;
+        APP_LOG(APP_LOG_LEVEL_INFO, "sprite name=%s load_ms=%d heap_bytes=%d peak_heap=%d",
+                monster_index[i].name, (int) elapsed, (int) (heap_bytes_used() - heap_before),
+                (int) heap_bytes_used());
+        gbitmap_destroy(sprite);
+    }
 }
 
+static void scene_heap_report() {
+    for (int i = 0; i < STATE_COUNT; i++) {
+        APP_LOG(APP_LOG_LEVEL_INFO, "scene_heap state=%d high_water=%d built=%d held=%d",
+                i, (int) scene_heap[i].high_water, scene_heap[i].built, scene_heap[i].held);
+    }
+    APP_LOG(APP_LOG_LEVEL_INFO, "heap used=%d free=%d cache=%d", (int) heap_bytes_used(),
+            (int) heap_bytes_free(), (int) resource_cache_heap);
+}
+
+static void select_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+    instrument_dump();
+    sprite_report();
+    scene_heap_report();
+}
+#endif
+
+// A long click subscription holds back single clicks on that button until
+// it is released, so long clicks are only subscribed in states that use
+// them. state_transition() runs this again when that changes.
 static void click_config_provider(void *context) {
   window_single_click_subscribe(BUTTON_ID_SELECT, select_click_handler);
   window_single_click_subscribe(BUTTON_ID_UP, up_click_handler);
   window_single_click_subscribe(BUTTON_ID_DOWN, down_click_handler);
+  if (scenes[state].on_up_long != NULL) {
+    window_long_click_subscribe(BUTTON_ID_UP, 0, up_long_click_handler, NULL);
+  }
+  if (scenes[state].on_down_long != NULL) {
+    window_long_click_subscribe(BUTTON_ID_DOWN, 0, down_long_click_handler, NULL);
+  }
+#ifdef INSTRUMENT
+  window_long_click_subscribe(BUTTON_ID_SELECT, 0, select_long_click_handler, NULL);
+#endif
+}
+
+static void preload_sprite(void *context) {
+    preload_timer = NULL;
+    if (preloaded_sprite == 0 && enemy_count > 0) {
+        preloaded_sprite = monster_index[enemies[target].monster].sprite;
+        resource_cache_bitmap(preloaded_sprite);
+    }
+}
+
+// Picks the next monster ahead of the battle and schedules loading its sprite
+static void encounter_preload() {
+    if (enemy_count == 0) {
+        journal_record(JOURNAL_PRELOAD, 0);
+        random_encounter();
+    }
+    if (preloaded_sprite == 0 && preload_timer == NULL) {
+        preload_timer = app_timer_register(PRELOAD_DELAY, preload_sprite, NULL);
+    }
+}
+
+// Drops the preload's reference, the sprite stays cached unless over budget
+static void preload_release() {
+    if (preload_timer != NULL) {
+        app_timer_cancel(preload_timer);
+        preload_timer = NULL;
+    }
+    if (preloaded_sprite != 0) {
+        resource_cache_release(preloaded_sprite);
+        preloaded_sprite = 0;
+    }
+}
+
+// Starts a battle once enough steps have been taken. A fight waits until
+// the journey screen is closed.
+static void encounter_check() {
+    if (movement_total < ENCOUNTER_STEPS || state != TRAVEL) {
+        return;
+    }
+    movement_total = 0;
+    save_mark_dirty(SAVE_DIRTY_TRAVEL);
+    encounter_started = now_ms();
+    journal_record(JOURNAL_ENCOUNTER, 0);
+    instrument_trace(TRACE_ENCOUNTER, 0);
+    vibes_double_pulse();
+    state_transition(BATTLE);
+}
+
+// Runs one batch of samples through the step detector and starts a
+// battle once enough steps have been taken. Returns the largest filtered
+// value in the batch.
+static int32_t query_accel(AccelData *accel_data, uint32_t num_samples) {
+    PROBE_BEGIN();
+    int32_t peak = 0;
+    int walked = 0;
+    for (uint32_t i = 0; i < num_samples; i++) {
+        AccelData *sample = &accel_data[i];
+        // our own vibrations are not steps
+        if (sample->did_vibrate) {
+            continue;
+        }
+        int32_t magnitude = isqrt(sample->x * sample->x + sample->y * sample->y + sample->z * sample->z);
+        if (accel_baseline == 0) {
+            accel_baseline = magnitude << 4;
+        }
+        accel_baseline += ((magnitude << 4) - accel_baseline) >> 3;
+        int32_t filtered = magnitude - (accel_baseline >> 4);
+        if (filtered > peak) {
+            peak = filtered;
+        }
+
+        samples_since_step++;
+        if (step_armed && filtered > STEP_THRESHOLD && samples_since_step >= STEP_MIN_GAP) {
+            step_armed = false;
+            samples_since_step = 0;
+            movement_total++;
+            walked++;
+        } else if (!step_armed && filtered < STEP_THRESHOLD - STEP_HYSTERESIS) {
+            step_armed = true;
+        }
+    }
+    //APP_LOG(APP_LOG_LEVEL_DEBUG, "Walked %d steps so far.", movement_total);
+    if (walked > 0) {
+        journey_log_add(walked);
+    }
+    if (movement_total >= ENCOUNTER_STEPS * PRELOAD_PERCENT / 100) {
+        encounter_preload();
+    }
+    encounter_check();
+    PROBE_END(PROBE_QUERY_ACCEL);
+    return peak;
+}
+
+static void handle_accel(AccelData *accel_data, uint32_t num_samples);
+static void journey_text_update();
+static void handle_tap(AccelAxisType axis, int32_t direction);
+static void travel_probe(void *context);
+
+static void travel_stream() {
+    accel_baseline = 0;
+    step_armed = true;
+    samples_since_step = 0;
+    idle_batches = 0;
+    accel_data_service_subscribe(ACCEL_BATCH_SIZE, handle_accel);
+    accel_service_set_sampling_rate(ACCEL_SAMPLING_10HZ);
+}
+
+static void travel_schedule_probe() {
+    BatteryChargeState battery = battery_state_service_peek();
+    if (battery.charge_percent <= LOW_BATTERY_PERCENT && !battery.is_charging) {
+        return;
+    }
+    probe_timer = app_timer_register(probe_interval, travel_probe, NULL);
+}
+
+// Stops streaming samples until something moves
+static void travel_sleep() {
+    travel_idle = true;
+    idle_started = time(NULL);
+    accel_data_service_unsubscribe();
+    // a subscription without samples keeps the accelerometer running for peeks
+    accel_data_service_subscribe(0, handle_accel);
+    accel_service_peek(&probe_last);
+    accel_tap_service_subscribe(handle_tap);
+    probe_interval = TRAVEL_PROBE_MIN;
+    travel_schedule_probe();
+}
+
+static void travel_wake() {
+    if (probe_timer != NULL) {
+        app_timer_cancel(probe_timer);
+        probe_timer = NULL;
+    }
+    accel_tap_service_unsubscribe();
+    accel_data_service_unsubscribe();
+    idle_seconds += time(NULL) - idle_started;
+    travel_idle = false;
 }
 
-static void handle_accel(AccelData *accel_data, uint32_t num_samples) { 
-    // do nothing                                                       
-}                                                                       
+static void travel_probe(void *context) {
+    probe_timer = NULL;
+    accel_wakeups++;
+    accel_samples++;
+    AccelData sample;
+    accel_service_peek(&sample);
+    int moved = abs(sample.x - probe_last.x) + abs(sample.y - probe_last.y) + abs(sample.z - probe_last.z);
+    probe_last = sample;
+    if (moved > TRAVEL_NOISE_FLOOR) {
+        travel_wake();
+        travel_stream();
+        return;
+    }
+    probe_interval = probe_interval * 2 < TRAVEL_PROBE_MAX ? probe_interval * 2 : TRAVEL_PROBE_MAX;
+    travel_schedule_probe();
+}
 
-static void query_accel(void *context) {
-    accel_prev = accel_current;
-    accel_service_peek(&accel_current);
-    int sum = 0;
-    sum += accel_current.x - accel_prev.x;
-    sum += accel_current.y - accel_prev.y;
-    sum += accel_current.z - accel_prev.z;
-    movement_total += custom_abs(sum);
-    //APP_LOG(APP_LOG_LEVEL_DEBUG, "Adding %d to total, total is now %d.", custom_abs(sum), movement_total);
-    if (movement_total > ENCOUNTER_FREQUENCY) {
-        movement_total = 0;
-        vibes_double_pulse();
-        state_transition(BATTLE);
+static void handle_tap(AccelAxisType axis, int32_t direction) {
+    accel_wakeups++;
+    travel_wake();
+    travel_stream();
+}
+
+static void handle_accel(AccelData *accel_data, uint32_t num_samples) {
+    accel_wakeups++;
+    accel_samples += num_samples;
+    int steps = movement_total;
+    int32_t peak = query_accel(accel_data, num_samples);
+    if (state == JOURNEY && movement_total != steps) {
+        journey_text_update();
+    }
+    if (!travel_walking) {
+        return;
+    }
+    if (movement_total != steps || peak > TRAVEL_NOISE_FLOOR) {
+        idle_batches = 0;
+    } else if (++idle_batches >= TRAVEL_IDLE_BATCHES) {
+        travel_sleep();
+    }
+}
+
+// Brings back an encounter from a save, dropping it if it doesn't fit
+// this build's monsters
+static void encounter_restore(int count, const uint8_t *monsters, const int8_t *health) {
+    if (count > MAX_ENEMIES || encounter_start(count) == NULL) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (monsters[i] >= MONSTER_COUNT) {
+            battle_arena_reset();
+            return;
+        }
+        enemies[i] = (Enemy) { .monster = monsters[i], .health = health[i] };
     }
+    if (encounter_alive() == 0) {
+        battle_arena_reset();
+    }
+}
 
-    travel_timer = app_timer_register(3000, query_accel, NULL);
+// Imports a game saved by a version that used one key per field
+static void legacy_stats_load() {
+    player_max_health = persist_read_int(PLAYER_MAX_HEALTH_KEY);
+    current_player_health = persist_read_int(PLAYER_CURRENT_HEALTH_KEY);
+    player_damage[WEAPON_SWORD] = persist_read_int(PLAYER_SWORD_DAMAGE_KEY);
+    player_damage[WEAPON_MAGIC] = persist_read_int(PLAYER_MAGIC_DAMAGE_KEY);
+    player_damage[WEAPON_BOW] = persist_read_int(PLAYER_BOW_DAMAGE_KEY);
+    if (persist_exists(MONSTER_CURRENT_HEALTH_KEY) && persist_exists(MONSTER_INDEX_KEY)) {
+        encounter_restore(1, (uint8_t[]) { persist_read_int(MONSTER_INDEX_KEY) },
+                          (int8_t[]) { persist_read_int(MONSTER_CURRENT_HEALTH_KEY) });
+    }
+    movement_total = persist_read_int(TRAVEL_PROGRESS_KEY);
+    state = persist_exists(STATE_KEY) ? persist_read_int(STATE_KEY) : WELCOME;
+    for (uint32_t key = PLAYER_MAX_HEALTH_KEY; key <= STATE_KEY; key++) {
+        persist_delete(key);
+    }
+    save_mark_dirty(SAVE_DIRTY_STATE | SAVE_DIRTY_STATS | SAVE_DIRTY_PLAYER_HEALTH | SAVE_DIRTY_BATTLE |
+                    SAVE_DIRTY_TRAVEL);
+    save_flush();
 }
 
 void stats_load() {
-    if (persist_exists(PLAYER_MAX_HEALTH_KEY)) {
-        player_max_health = persist_read_int(PLAYER_MAX_HEALTH_KEY);
-        current_player_health = persist_read_int(PLAYER_CURRENT_HEALTH_KEY);
-        player_sword_damage = persist_read_int(PLAYER_SWORD_DAMAGE_KEY);
-        player_magic_damage = persist_read_int(PLAYER_MAGIC_DAMAGE_KEY);
-        player_bow_damage = persist_read_int(PLAYER_BOW_DAMAGE_KEY);
+    SaveGame save;
+    memset(&save, 0, sizeof(save));
+    rng_seed(time(NULL));
+    instrument_persist_read(sizeof(save));
+    if (persist_read_data(SAVE_KEY, &save, sizeof(save)) > 0 && save.version <= SAVE_VERSION) {
+        state = save.state < STATE_COUNT ? save.state : WELCOME;
+        if (save.enemy_count > 0) {
+            encounter_restore(save.enemy_count, save.enemy_monsters, save.enemy_health);
+            target = save.target < enemy_count ? save.target : 0;
+        } else if (save.monster_index >= 0) {
+            encounter_restore(1, (uint8_t[]) { save.monster_index }, (int8_t[]) { save.monster_health });
+        }
+        player_max_health = save.player_max_health;
+        current_player_health = save.player_current_health;
+        for (int weapon = 0; weapon < WEAPON_COUNT && weapon < SAVE_WEAPONS; weapon++) {
+            player_damage[weapon] = save.player_damage[weapon];
+        }
+        if (save.rng_state != 0) {
+            rng_state = save.rng_state;
+        }
+        // a fight that was due when the app closed is still due
+        movement_total = save.movement_total < 0 ? 0 : save.movement_total > ENCOUNTER_STEPS ? ENCOUNTER_STEPS :
+                         save.movement_total;
+    } else if (persist_exists(PLAYER_MAX_HEALTH_KEY)) {
+        legacy_stats_load();
     } else {
         //APP_LOG(APP_LOG_LEVEL_DEBUG, "Stats did not exist, resetting.");
-        player_max_health = 10;
-        current_player_health = player_max_health;
-        player_sword_damage = 1;
-        player_magic_damage = 1;
-        player_bow_damage = 1;
-        persist_write_int(PLAYER_MAX_HEALTH_KEY, player_max_health);
-        persist_write_int(PLAYER_CURRENT_HEALTH_KEY, player_max_health);
-        persist_write_int(PLAYER_SWORD_DAMAGE_KEY, player_sword_damage);
-        persist_write_int(PLAYER_MAGIC_DAMAGE_KEY, player_magic_damage);
-        persist_write_int(PLAYER_BOW_DAMAGE_KEY, player_bow_damage);
-    }
-}
-
-static void monster_load() { 
-    // Tentacle Mage
-    tentacle_mage.health = 5;
-    tentacle_mage.resistances = MAGIC_DAMAGE;
-    tentacle_mage.hit_chance = 0.3;
-    tentacle_mage.damage = 2;
-    tentacle_mage.sprite = RESOURCE_ID_MONSTER_TENTACLE_MAGE;
-    tentacle_mage.name = "Tentacle Mage";
-    tentacle_mage.stat_boost = MAGIC_DAMAGE;
-    
-    // Ent
-    ent.health = 10;
-    ent.resistances = BOW_DAMAGE;
-    ent.hit_chance = 0.5;
-    ent.damage = 1;
-    ent.sprite = RESOURCE_ID_MONSTER_ENT;
-    ent.name = "Ent";
-    ent.stat_boost = MAGIC_DAMAGE;
-
-    // Horned Guard
-    horned_guard.health = 7;
-    horned_guard.resistances = SWORD_DAMAGE;
-    horned_guard.hit_chance = 0.5;
-    horned_guard.damage = 1;
-    horned_guard.sprite = RESOURCE_ID_MONSTER_HORNED_GUARD;
-    horned_guard.name = "Horned Guard";
-    horned_guard.stat_boost = SWORD_DAMAGE;
-    
-    // Centaur Slaver
-    centaur_slaver.health = 8;
-    centaur_slaver.resistances = SWORD_DAMAGE;
-    centaur_slaver.hit_chance = 0.3;
-    centaur_slaver.damage = 1;
-    centaur_slaver.sprite = RESOURCE_ID_MONSTER_CENTAUR_SLAVER;
-    centaur_slaver.name = "Centaur Slaver";
-    centaur_slaver.stat_boost = SWORD_DAMAGE;
-
-    // Disturbed Wraith
-    disturbed_wraith.health = 3;
-    disturbed_wraith.resistances = SWORD_DAMAGE | BOW_DAMAGE;
-    disturbed_wraith.hit_chance = 0.6;
-    disturbed_wraith.damage = 1;
-    disturbed_wraith.sprite = RESOURCE_ID_MONSTER_DISTURBED_WRAITH;
-    disturbed_wraith.name = "Disturbed Wraith";
-    disturbed_wraith.stat_boost = MAGIC_DAMAGE;
-
-    // Eye Fiend
-    eye_fiend.health = 3;
-    eye_fiend.resistances = MAGIC_DAMAGE;
-    eye_fiend.hit_chance = 0.7;
-    eye_fiend.damage = 1;
-    eye_fiend.sprite = RESOURCE_ID_MONSTER_EYE_FIEND;
-    eye_fiend.name = "Eye Fiend";
-    eye_fiend.stat_boost = BOW_DAMAGE;
-
-    // Juvenile Wyrm
-    juvenile_wyrm.health = 7;
-    juvenile_wyrm.resistances = SWORD_DAMAGE | MAGIC_DAMAGE;
-    juvenile_wyrm.hit_chance = 0.5;
-    juvenile_wyrm.damage = 1;
-    juvenile_wyrm.sprite = RESOURCE_ID_MONSTER_JUVENILE_WYRM;
-    juvenile_wyrm.name = "Juvenile Wyrm";
-    juvenile_wyrm.stat_boost = BOW_DAMAGE;
-
-    // Noxious Slime
-    noxious_slime.health = 6;
-    noxious_slime.resistances = NO_RESISTANCES;
-    noxious_slime.hit_chance = 0.3;
-    noxious_slime.damage = 2;
-    noxious_slime.sprite = RESOURCE_ID_MONSTER_NOXIOUS_SLIME;
-    noxious_slime.name = "Noxious Slime";
-    noxious_slime.stat_boost = BOW_DAMAGE;
-
-    // Pixel Golem
-    pixel_golem.health = 7;
-    pixel_golem.resistances = MAGIC_DAMAGE;
-    pixel_golem.hit_chance = 0.5;
-    pixel_golem.damage = 1;
-    pixel_golem.sprite = RESOURCE_ID_MONSTER_PIXEL_GOLEM;
-    pixel_golem.name = "Pixel Golem";
-    pixel_golem.stat_boost = MAGIC_DAMAGE;
-
-    // Small Fish
-    small_fish.health = 2;
-    small_fish.resistances = NO_RESISTANCES;
-    small_fish.hit_chance = 0.1;
-    small_fish.damage = 4;
-    small_fish.sprite = RESOURCE_ID_MONSTER_SMALL_FISH;
-    small_fish.name = "Small Fish";
-    small_fish.stat_boost = BOW_DAMAGE;
-
-    // Vengeful Djinn
-    vengeful_djinn.health = 3;
-    vengeful_djinn.resistances = SWORD_DAMAGE;
-    vengeful_djinn.hit_chance = 0.3;
-    vengeful_djinn.damage = 3;
-    vengeful_djinn.sprite = RESOURCE_ID_MONSTER_VENGEFUL_DJINN;
-    vengeful_djinn.name = "Vengeful Djinn";
-    vengeful_djinn.stat_boost = BOW_DAMAGE;
-
-    monster_index[0] = &tentacle_mage;
-    monster_index[1] = &ent;
-    monster_index[2] = &horned_guard;
-    monster_index[3] = &centaur_slaver;
-    monster_index[4] = &disturbed_wraith;
-    monster_index[5] = &eye_fiend;
-    monster_index[6] = &juvenile_wyrm;
-    monster_index[7] = &noxious_slime;
-    monster_index[8] = &pixel_golem;
-    monster_index[9] = &small_fish;
+        state = WELCOME;
+        stats_reset();
+    }
+    encounter_table_update();
 }
 
 void monster_health_update(Layer *layer, GContext* ctx) {
+    PROBE_BEGIN();
+    if (encounter_started != 0) {
+        int elapsed = now_ms() - encounter_started;
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Encounter to first frame took %dms.", elapsed);
+        instrument_budget("encounter_first_frame_ms", elapsed, ENCOUNTER_FRAME_BUDGET);
+        encounter_started = 0;
+    }
     graphics_context_set_fill_color(ctx, GColorBlack);
-    float percent_health = ((float) current_monster_health) / ((float) current_battle->health);
-    graphics_fill_rect(ctx, GRect(0, 0, (int)(percent_health * 75.0), 4), 0, GCornerNone);
+    graphics_fill_rect(ctx, GRect(0, 0, bar_width_shown, 4), 0, GCornerNone);
+    PROBE_END(PROBE_DRAW_HEALTH_BAR);
 }
 
-static void battle_load(Window *window) {
+// Heap in use outside the resource cache
+static int heap_outside_cache() {
+  return (int) heap_bytes_used() - (int) resource_cache_heap;
+}
+
+// Charges a scene's load or unload with whatever it allocated or freed
+#define SCENE_HEAP_BEGIN() int heap_started = heap_outside_cache()
+#define SCENE_HEAP_END(scene) scene_heap[scene].held += heap_outside_cache() - heap_started
+
+static void scene_heap_built(int scene, int started) {
+  scene_heap[scene].built = heap_outside_cache() - started;
+  instrument_budget("scene_build_bytes", scene_heap[scene].built, scene_build_budget[scene]);
+}
+
+// Checks a scene's destroy gave back everything its build took
+static void scene_heap_destroyed(int scene, int started) {
+  int freed = started - heap_outside_cache();
+  if (freed != scene_heap[scene].built) {
+      APP_LOG(APP_LOG_LEVEL_WARNING, "Scene %d freed %d of the %d bytes it was built with.",
+              scene, freed, scene_heap[scene].built);
+  }
+  instrument_budget("scene_destroy_leak_bytes", scene_heap[scene].built - freed, 0);
+  scene_heap[scene].held -= freed;
+  scene_heap[scene].built = 0;
+}
+
+static void heap_cycle_check();
+
+// Reads what launching left for after the first frame. Anything that needs
+// these loads before then does them itself.
+static void launch_load() {
+  journal_load();
+  journey_log_load();
+  telemetry_load();
+}
+
+// Does the rest of launching once the first frame is up
+static void launch_finish() {
+  if (launch_finished) {
+      return;
+  }
+  launch_finished = true;
+  launch_load();
+  telemetry_open();
+  // AppMessage's buffers stay for the whole session, the heap checked
+  // over a run starts from here
+  heap_cycle_check();
+  if (launch_drawn) {
+      int elapsed = now_ms() - launch_started;
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Launch to interactive took %dms.", elapsed);
+      instrument_budget("launch_interactive_ms", elapsed, LAUNCH_INTERACTIVE_BUDGET);
+  }
+}
+
+static void launch_finish_callback(void *context) {
+  launch_finish();
+}
+
+// Scene roots draw nothing themselves, this only times the first frame
+static void scene_update(Layer *layer, GContext* ctx) {
+  PROBE_BEGIN();
+  if (launch_drawn) {
+      PROBE_END(PROBE_DRAW_SCENE);
+      return;
+  }
+  launch_drawn = true;
+  int elapsed = now_ms() - launch_started;
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Launch to first frame took %dms.", elapsed);
+  instrument_budget("launch_first_frame_ms", elapsed, LAUNCH_FRAME_BUDGET);
+  app_timer_register(0, launch_finish_callback, NULL);
+  PROBE_END(PROBE_DRAW_SCENE);
+}
+
+// Creates a hidden, full-window root layer for a scene
+static Layer* scene_create(Window *window) {
   Layer *window_layer = window_get_root_layer(window);
-  if (persist_exists(MONSTER_CURRENT_HEALTH_KEY) && persist_exists(MONSTER_INDEX_KEY)) {
-      current_battle = monster_index[persist_read_int(MONSTER_INDEX_KEY)]; 
-      current_monster_health = persist_read_int(MONSTER_CURRENT_HEALTH_KEY);
-  } else {
-      current_battle = random_encounter();
-      current_monster_health = current_battle->health;
+  Layer *scene = layer_create(layer_get_bounds(window_layer));
+  layer_set_update_proc(scene, scene_update);
+  layer_set_hidden(scene, true);
+  layer_add_child(window_layer, scene);
+  return scene;
+}
+
+static void weapon_icons_update(Layer *layer, GContext* ctx) {
+  PROBE_BEGIN();
+  for (int i = 0; i < WEAPON_COUNT; i++) {
+      GRect frame = { weapon_icons[i].position, weapon_icons[i].source.size };
+      graphics_draw_bitmap_in_rect(ctx, weapon_icon_bitmaps[i], frame);
   }
+  PROBE_END(PROBE_DRAW_WEAPON_ICONS);
+}
+
+static void battle_build(Window *window) {
+  int started = heap_outside_cache();
+  battle_scene = scene_create(window);
 
   enemy_name = text_layer_create((GRect) { .origin = { 10, 10 }, .size = { 100, 20 } });
-  text_layer_set_text(enemy_name, current_battle->name);
   text_layer_set_text_alignment(enemy_name, GTextAlignmentCenter);
-  layer_add_child(window_layer, text_layer_get_layer(enemy_name));
+  layer_add_child(battle_scene, text_layer_get_layer(enemy_name));
 
   player_health_label = text_layer_create((GRect) { .origin = { 10, 130 }, .size = { 80, 20 } });
   text_layer_set_text(player_health_label, "Your Health:");
-  layer_add_child(window_layer, text_layer_get_layer(player_health_label));
+  layer_add_child(battle_scene, text_layer_get_layer(player_health_label));
 
   player_health = text_layer_create((GRect) { .origin = { 90, 130 }, .size = { 40, 20 } });
-  snprintf(player_health_str, 3, "%d", current_player_health);
   text_layer_set_text(player_health, player_health_str);
-  layer_add_child(window_layer, text_layer_get_layer(player_health));
-
-  sword_layer = bitmap_layer_create((GRect) { .origin = { 130, 10 }, .size = { 10, 10 } }); 
-  sword_icon = gbitmap_create_with_resource(RESOURCE_ID_SWORD_ICON);
-  bitmap_layer_set_bitmap(sword_layer, sword_icon);
-  layer_add_child(window_layer, bitmap_layer_get_layer(sword_layer));
+  layer_add_child(battle_scene, text_layer_get_layer(player_health));
 
-  magic_layer = bitmap_layer_create((GRect) { .origin = { 130, 65 }, .size = { 10, 10 } }); 
-  magic_icon = gbitmap_create_with_resource(RESOURCE_ID_MAGIC_ICON);
-  bitmap_layer_set_bitmap(magic_layer, magic_icon);
-  layer_add_child(window_layer, bitmap_layer_get_layer(magic_layer));
+  odds_text = text_layer_create((GRect) { .origin = { 10, 148 }, .size = { 120, 20 } });
+  text_layer_set_text(odds_text, odds_str);
+  layer_add_child(battle_scene, text_layer_get_layer(odds_text));
 
-  bow_layer = bitmap_layer_create((GRect) { .origin = { 130, 130 }, .size = { 10, 10 } }); 
-  bow_icon = gbitmap_create_with_resource(RESOURCE_ID_BOW_ICON);
-  bitmap_layer_set_bitmap(bow_layer, bow_icon);
-  layer_add_child(window_layer, bitmap_layer_get_layer(bow_layer));
+  weapon_layer = layer_create((GRect) { .origin = { 130, 10 }, .size = { 10, 130 } });
+  weapon_atlas = resource_cache_bitmap(RESOURCE_ID_WEAPON_ATLAS);
+  for (int i = 0; i < WEAPON_COUNT; i++) {
+      weapon_icon_bitmaps[i] = gbitmap_create_as_sub_bitmap(weapon_atlas, weapon_icons[i].source);
+  }
+  layer_set_update_proc(weapon_layer, weapon_icons_update);
+  layer_add_child(battle_scene, weapon_layer);
 
   monster_layer = bitmap_layer_create((GRect) { .origin = { 20, 40 }, .size = { 75, 75 } });
-  monster_sprite = gbitmap_create_with_resource(current_battle->sprite);
-  bitmap_layer_set_bitmap(monster_layer, monster_sprite);
-  layer_add_child(window_layer, bitmap_layer_get_layer(monster_layer));
+  layer_add_child(battle_scene, bitmap_layer_get_layer(monster_layer));
 
-  GRect monster_health_frame = GRect(20, 125, 75, 4);
+  GRect monster_health_frame = GRect(20, 125, HEALTH_BAR_WIDTH, 4);
   monster_health_layer = layer_create(monster_health_frame);
   layer_set_update_proc(monster_health_layer, monster_health_update);
-  layer_add_child(window_layer, monster_health_layer); 
+  layer_add_child(battle_scene, monster_health_layer); 
+  scene_heap_built(BATTLE, started);
 }
 
-static void battle_unload(Window *window) {
+static void battle_destroy() {
+  int started = heap_outside_cache();
   text_layer_destroy(enemy_name);
   text_layer_destroy(player_health_label);
   text_layer_destroy(player_health);
+  text_layer_destroy(odds_text);
 
-  gbitmap_destroy(sword_icon);
-  gbitmap_destroy(magic_icon);
-  gbitmap_destroy(bow_icon);
-  gbitmap_destroy(monster_sprite);
+  for (int i = 0; i < WEAPON_COUNT; i++) {
+      gbitmap_destroy(weapon_icon_bitmaps[i]);
+  }
+  resource_cache_release(RESOURCE_ID_WEAPON_ATLAS);
+  layer_destroy(weapon_layer);
 
-  bitmap_layer_destroy(sword_layer);
-  bitmap_layer_destroy(magic_layer);
-  bitmap_layer_destroy(bow_layer);
   bitmap_layer_destroy(monster_layer);
 
   layer_destroy(monster_health_layer);
+  layer_destroy(battle_scene);
+  battle_scene = NULL;
+  shown_sprite = NULL;
+  scene_heap_destroyed(BATTLE, started);
 }
 
-static void death_load(Window *window) {
-  Layer *window_layer = window_get_root_layer(window);
-  GRect bounds = layer_get_bounds(window_layer);
+static void battle_load(Window *window) {
+  SCENE_HEAP_BEGIN();
+  PROBE_BEGIN();
+  if (enemy_count == 0) {
+      random_encounter();
+  }
+  if (enemies[target].health <= 0) {
+      encounter_next_target(1);
+  }
+  current_battle = &monster_index[enemies[target].monster];
+  damage_matrix_update();
+  battle_flash_writes = 0;
+
+  if (battle_scene == NULL) {
+      battle_build(window);
+  }
+  monster_sprite = resource_cache_bitmap(current_battle->sprite);
+  preload_release();
+  battle_show_target();
+  bar_stop();
+  layer_mark_dirty(monster_health_layer);
+  battle_invalidate(BATTLE_DIRTY_PLAYER_HEALTH);
+  layer_set_hidden(battle_scene, false);
+  PROBE_END(PROBE_BATTLE_LOAD);
+  SCENE_HEAP_END(BATTLE);
+}
+
+static void battle_unload(Window *window) {
+  SCENE_HEAP_BEGIN();
+  bar_stop();
+  layer_set_hidden(battle_scene, true);
+  resource_cache_release(current_battle->sprite);
+
+  int dealt[3] = { 0, 0, 0 };
+  int taken = 0;
+  for (int i = 0; i < damage_log_count; i++) {
+      dealt[damage_log[i].weapon] += damage_log[i].dealt;
+      taken += damage_log[i].taken;
+  }
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Battle: %d presses, dealt %d sword/%d magic/%d bow, took %d.",
+          damage_log_count, dealt[0], dealt[1], dealt[2], taken);
+  // a fight that isn't over goes on after a relaunch, so it has to reach
+  // flash before its enemies are dropped
+  if (enemy_count > 0) {
+      save_flush();
+  }
+  battle_arena_reset();
+  SCENE_HEAP_END(BATTLE);
+}
+
+static void battle_sword() {
+  attack(WEAPON_SWORD);
+}
+
+static void battle_magic() {
+  attack(WEAPON_MAGIC);
+}
+
+static void battle_bow() {
+  attack(WEAPON_BOW);
+}
+
+static void battle_target_previous() {
+  battle_change_target(-1);
+}
+
+static void battle_target_next() {
+  battle_change_target(1);
+}
+
+static void death_build(Window *window) {
+  int started = heap_outside_cache();
+  death_scene = scene_create(window);
+  GRect bounds = layer_get_bounds(death_scene);
   death_text = text_layer_create((GRect) { .origin = { 0, 30 }, .size = { bounds.size.w, 90 } });
   text_layer_set_text(death_text, "YOU\nDIED");
   text_layer_set_text_alignment(death_text, GTextAlignmentCenter);
-  text_layer_set_font(death_text, fonts_load_custom_font(resource_get_handle(RESOURCE_ID_STONECROSS_20)));
-  layer_add_child(window_layer, text_layer_get_layer(death_text)); 
+  text_layer_set_font(death_text, resource_cache_font(RESOURCE_ID_STONECROSS_20));
+  layer_add_child(death_scene, text_layer_get_layer(death_text)); 
+
+  death_press_a_key = text_layer_create((GRect) { .origin = { 0, 130 }, .size = { bounds.size.w, 20 } });
+  text_layer_set_text(death_press_a_key, "Press a button");
+  text_layer_set_text_alignment(death_press_a_key, GTextAlignmentCenter);
+  layer_add_child(death_scene, text_layer_get_layer(death_press_a_key)); 
+  scene_heap_built(DEATH, started);
+}
 
-  press_a_key = text_layer_create((GRect) { .origin = { 0, 130 }, .size = { bounds.size.w, 20 } });
-  text_layer_set_text(press_a_key, "Press a button");
-  text_layer_set_text_alignment(press_a_key, GTextAlignmentCenter);
-  layer_add_child(window_layer, text_layer_get_layer(press_a_key)); 
+static void death_destroy() {
+  int started = heap_outside_cache();
+  text_layer_destroy(death_text); 
+  text_layer_destroy(death_press_a_key); 
+  resource_cache_release(RESOURCE_ID_STONECROSS_20);
+  layer_destroy(death_scene);
+  death_scene = NULL;
+  scene_heap_destroyed(DEATH, started);
+}
 
+static void death_load(Window *window) {
+  SCENE_HEAP_BEGIN();
+  if (death_scene == NULL) {
+      death_build(window);
+  }
+  layer_set_hidden(death_scene, false);
   vibes_long_pulse();
+  SCENE_HEAP_END(DEATH);
 }
 
 static void death_unload(Window *window) {
-  text_layer_destroy(death_text); 
-  text_layer_destroy(press_a_key); 
+  SCENE_HEAP_BEGIN();
+  layer_set_hidden(death_scene, true);
+  SCENE_HEAP_END(DEATH);
 }
 
-static void welcome_load(Window *window) {
-  Layer *window_layer = window_get_root_layer(window);
-  GRect bounds = layer_get_bounds(window_layer);
+static void death_continue() {
+  state_transition(WELCOME);
+}
+
+static void welcome_build(Window *window) {
+  int started = heap_outside_cache();
+  welcome_scene = scene_create(window);
+  GRect bounds = layer_get_bounds(welcome_scene);
   welcome_text = text_layer_create((GRect) { .origin = { 0, 30 }, .size = { bounds.size.w, 90 } });
   text_layer_set_text(welcome_text, "THE\nLEGEND\nOF XOR");
   text_layer_set_text_alignment(welcome_text, GTextAlignmentCenter);
-  text_layer_set_font(welcome_text, fonts_load_custom_font(resource_get_handle(RESOURCE_ID_STONECROSS_20)));
-  layer_add_child(window_layer, text_layer_get_layer(welcome_text)); 
+  text_layer_set_font(welcome_text, resource_cache_font(RESOURCE_ID_STONECROSS_20));
+  layer_add_child(welcome_scene, text_layer_get_layer(welcome_text)); 
+
+  welcome_press_a_key = text_layer_create((GRect) { .origin = { 0, 130 }, .size = { bounds.size.w, 20 } });
+  text_layer_set_text(welcome_press_a_key, "Press a button");
+  text_layer_set_text_alignment(welcome_press_a_key, GTextAlignmentCenter);
+  layer_add_child(welcome_scene, text_layer_get_layer(welcome_press_a_key)); 
+  scene_heap_built(WELCOME, started);
+}
 
-  press_a_key = text_layer_create((GRect) { .origin = { 0, 130 }, .size = { bounds.size.w, 20 } });
-  text_layer_set_text(press_a_key, "Press a button");
-  text_layer_set_text_alignment(press_a_key, GTextAlignmentCenter);
-  layer_add_child(window_layer, text_layer_get_layer(press_a_key)); 
+static void welcome_destroy() {
+  int started = heap_outside_cache();
+  text_layer_destroy(welcome_text); 
+  text_layer_destroy(welcome_press_a_key); 
+  resource_cache_release(RESOURCE_ID_STONECROSS_20);
+  layer_destroy(welcome_scene);
+  welcome_scene = NULL;
+  scene_heap_destroyed(WELCOME, started);
+}
 
-  // this is so that when we restart, player variables are set back to the baseline
-  stats_load();
+static void welcome_load(Window *window) {
+  SCENE_HEAP_BEGIN();
+  if (welcome_scene == NULL) {
+      welcome_build(window);
+  }
+  layer_set_hidden(welcome_scene, false);
+  SCENE_HEAP_END(WELCOME);
 }
 
 static void welcome_unload(Window *window) {
-  text_layer_destroy(welcome_text); 
-  text_layer_destroy(press_a_key); 
+  SCENE_HEAP_BEGIN();
+  layer_set_hidden(welcome_scene, true);
+  SCENE_HEAP_END(WELCOME);
+}
+
+static void welcome_continue() {
+  state_transition(TRAVEL);
+}
+
+static void travel_build(Window *window) {
+  int started = heap_outside_cache();
+  travel_scene = scene_create(window);
+  GRect bounds = layer_get_bounds(travel_scene);
+  travel_text = text_layer_create((GRect) { .origin = { 0, 30 }, .size = { bounds.size.w, 90 } });
+  text_layer_set_text(travel_text, "TRAVELING");
+  text_layer_set_text_alignment(travel_text, GTextAlignmentCenter);
+  text_layer_set_font(travel_text, resource_cache_font(RESOURCE_ID_STONECROSS_20));
+  layer_add_child(travel_scene, text_layer_get_layer(travel_text)); 
+
+  travel_hint = text_layer_create((GRect) { .origin = { 0, 130 }, .size = { bounds.size.w, 20 } });
+  text_layer_set_text(travel_hint, "Select: journey");
+  text_layer_set_text_alignment(travel_hint, GTextAlignmentCenter);
+  layer_add_child(travel_scene, text_layer_get_layer(travel_hint)); 
+  scene_heap_built(TRAVEL, started);
+}
+
+static void travel_destroy() {
+  int started = heap_outside_cache();
+  text_layer_destroy(travel_text); 
+  text_layer_destroy(travel_hint); 
+  resource_cache_release(RESOURCE_ID_STONECROSS_20);
+  layer_destroy(travel_scene);
+  travel_scene = NULL;
+  scene_heap_destroyed(TRAVEL, started);
+}
+
+// Starts counting steps, and the power cost of this stretch of travel
+static void travel_begin() {
+  travel_walking = true;
+  travel_started = time(NULL);
+  journey_log_load();
+  travel_start_steps = journey_log.total_steps;
+  idle_seconds = 0;
+  accel_wakeups = 0;
+  accel_samples = 0;
+  travel_stream();
+}
+
+// Stops counting steps, saving and reporting what was walked
+static void travel_end() {
+  travel_walking = false;
+  // whatever was walked since the last checkpoint goes out with this transition
+  if (steps_unsaved > 0) {
+      save_mark_dirty(SAVE_DIRTY_TRAVEL | SAVE_DIRTY_JOURNEY);
+      steps_unsaved = 0;
+  }
+  if (journey_log.total_steps != travel_start_steps) {
+      report(TELEMETRY_TRAVEL, 0, journey_log.total_steps - travel_start_steps);
+  }
+  if (travel_idle) {
+      travel_wake();
+  } else {
+      accel_data_service_unsubscribe();
+  }
+  if (preload_timer != NULL) {
+      app_timer_cancel(preload_timer);
+      preload_timer = NULL;
+  }
+
+  int elapsed = time(NULL) - travel_started;
+  if (elapsed > 0) {
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Travel: %d wakeups/hour, %d samples in %ds, %d%% idle.",
+              (int) (accel_wakeups * 3600 / elapsed), (int) accel_samples, elapsed,
+              idle_seconds * 100 / elapsed);
+  }
 }
 
 static void travel_load(Window *window) {
-  Layer *window_layer = window_get_root_layer(window);
-  GRect bounds = layer_get_bounds(window_layer);
-  welcome_text = text_layer_create((GRect) { .origin = { 0, 30 }, .size = { bounds.size.w, 90 } });
-  text_layer_set_text(welcome_text, "TRAVELING");
-  text_layer_set_text_alignment(welcome_text, GTextAlignmentCenter);
-  text_layer_set_font(welcome_text, fonts_load_custom_font(resource_get_handle(RESOURCE_ID_STONECROSS_20)));
-  layer_add_child(window_layer, text_layer_get_layer(welcome_text)); 
+  SCENE_HEAP_BEGIN();
+  if (travel_scene == NULL) {
+      travel_build(window);
+  }
+  layer_set_hidden(travel_scene, false);
+  if (!travel_walking) {
+      travel_begin();
+  }
 
-  accel_data_service_subscribe(0, handle_accel);
-  accel_service_peek(&accel_prev);
-  travel_timer = app_timer_register(3000, query_accel, NULL);
+  // a monster picked before the app was closed still needs its sprite
+  if (enemy_count > 0) {
+      encounter_preload();
+  }
+  SCENE_HEAP_END(TRAVEL);
 }
 
 static void travel_unload(Window *window) {
-  text_layer_destroy(welcome_text); 
+  SCENE_HEAP_BEGIN();
+  layer_set_hidden(travel_scene, true);
+  // the journey screen keeps counting steps, anywhere else travel is over
+  if (!journey_open) {
+      travel_end();
+  }
+  SCENE_HEAP_END(TRAVEL);
+}
+
+static void travel_open_journey() {
+  journey_open = true;
+  state_transition(JOURNEY);
+}
+
+// Bars for the steps of the last JOURNEY_CHART_HOURS hours, newest on the
+// right, unpacked from the run-length coded history
+static void journey_chart_update(Layer *layer, GContext* ctx) {
+  PROBE_BEGIN();
+  int hours[JOURNEY_CHART_HOURS];
+  int shown = 0;
+  int tallest = 1;
+  hours[shown++] = (journey_log.hour_steps + JOURNEY_STEP_UNIT / 2) / JOURNEY_STEP_UNIT;
+  for (int i = 0; i < journey_log.count && shown < JOURNEY_CHART_HOURS; i++) {
+      JourneyRun *run = &journey_log.runs[(journey_log.head + JOURNEY_RUNS - 1 - i) % JOURNEY_RUNS];
+      for (int h = 0; h < run->hours && shown < JOURNEY_CHART_HOURS; h++) {
+          hours[shown++] = run->steps;
+      }
+  }
+  for (int i = 0; i < shown; i++) {
+      tallest = hours[i] > tallest ? hours[i] : tallest;
+  }
+  GRect bounds = layer_get_bounds(layer);
+  int width = bounds.size.w / JOURNEY_CHART_HOURS;
+  graphics_context_set_fill_color(ctx, GColorBlack);
+  for (int i = 0; i < shown; i++) {
+      int height = hours[i] * bounds.size.h / tallest;
+      int x = bounds.size.w - (i + 1) * width;
+      graphics_fill_rect(ctx, GRect(x, bounds.size.h - height, width - 1, height), 0, GCornerNone);
+  }
+  PROBE_END(PROBE_DRAW_JOURNEY_CHART);
+}
+
+static void journey_build(Window *window) {
+  int started = heap_outside_cache();
+  journey_scene = scene_create(window);
+  GRect bounds = layer_get_bounds(journey_scene);
+  journey_title = text_layer_create((GRect) { .origin = { 0, 5 }, .size = { bounds.size.w, 25 } });
+  text_layer_set_text(journey_title, "JOURNEY");
+  text_layer_set_text_alignment(journey_title, GTextAlignmentCenter);
+  text_layer_set_font(journey_title, resource_cache_font(RESOURCE_ID_STONECROSS_20));
+  layer_add_child(journey_scene, text_layer_get_layer(journey_title)); 
+
+  journey_text = text_layer_create((GRect) { .origin = { 10, 35 }, .size = { bounds.size.w - 20, 55 } });
+  text_layer_set_text(journey_text, journey_str);
+  layer_add_child(journey_scene, text_layer_get_layer(journey_text)); 
+
+  journey_chart = layer_create((GRect) { .origin = { 12, 95 }, .size = { 120, 40 } });
+  layer_set_update_proc(journey_chart, journey_chart_update);
+  layer_add_child(journey_scene, journey_chart);
+
+  journey_caption = text_layer_create((GRect) { .origin = { 0, 140 }, .size = { bounds.size.w, 20 } });
+  text_layer_set_text(journey_caption, "Steps per hour, last day");
+  text_layer_set_text_alignment(journey_caption, GTextAlignmentCenter);
+  layer_add_child(journey_scene, text_layer_get_layer(journey_caption)); 
+  scene_heap_built(JOURNEY, started);
+}
+
+static void journey_destroy() {
+  int started = heap_outside_cache();
+  text_layer_destroy(journey_title); 
+  text_layer_destroy(journey_text); 
+  text_layer_destroy(journey_caption); 
+  layer_destroy(journey_chart);
+  resource_cache_release(RESOURCE_ID_STONECROSS_20);
+  layer_destroy(journey_scene);
+  journey_scene = NULL;
+  scene_heap_destroyed(JOURNEY, started);
+}
 
-  accel_data_service_unsubscribe();
-  app_timer_cancel(travel_timer);
+static void journey_text_update() {
+  int fight_in = movement_total < ENCOUNTER_STEPS ? ENCOUNTER_STEPS - movement_total : 0;
+  snprintf(journey_str, sizeof(journey_str), "%d steps walked\n%d this hour\nFight in %d steps",
+           (int) journey_log.total_steps, journey_log.hour_steps, fight_in);
+  layer_mark_dirty(text_layer_get_layer(journey_text));
+  layer_mark_dirty(journey_chart);
 }
 
+static void journey_load(Window *window) {
+  SCENE_HEAP_BEGIN();
+  if (journey_scene == NULL) {
+      journey_build(window);
+  }
+  // launched straight into the journey screen
+  if (!travel_walking) {
+      travel_begin();
+  }
+  journey_log_load();
+  journey_log_roll();
+  journey_text_update();
+  layer_set_hidden(journey_scene, false);
+  SCENE_HEAP_END(JOURNEY);
+}
+
+static void journey_unload(Window *window) {
+  SCENE_HEAP_BEGIN();
+  layer_set_hidden(journey_scene, true);
+  SCENE_HEAP_END(JOURNEY);
+}
+
+static void journey_close() {
+  journey_open = false;
+  state_transition(TRAVEL);
+  // steps walked on the journey screen may have made a fight due
+  encounter_check();
+}
+
+// Updates the heap high-water mark of the scene that is showing
+static void scene_heap_check() {
+  size_t used = heap_bytes_used();
+  if (used > scene_heap[state].high_water) {
+      scene_heap[state].high_water = used;
+  }
+}
+
+// Each time the welcome screen comes back after a whole run through travel,
+// battle and death, heap use outside the cache and the retained scenes
+// should be exactly what it was the last time it showed
+static void heap_cycle_check() {
+  if (!launch_finished) {
+      return;
+  }
+  cycle_states |= 1 << state;
+  if (state != WELCOME) {
+      return;
+  }
+  int used = heap_outside_cache();
+  for (int i = 0; i < STATE_COUNT; i++) {
+      used -= scene_heap[i].built;
+  }
+  uint8_t run = 1 << BATTLE | 1 << TRAVEL | 1 << WELCOME | 1 << DEATH;
+  if ((cycle_states & run) == run && cycle_heap_start >= 0) {
+      int leaked = used - cycle_heap_start;
+      if (leaked != 0) {
+          APP_LOG(APP_LOG_LEVEL_WARNING, "Heap grew by %d bytes over a whole run.", leaked);
+      }
+      instrument_budget("run_leak_bytes", leaked, 0);
+  }
+  cycle_heap_start = used;
+  cycle_states = 1 << WELCOME;
+}
+
+static const Scene scenes[STATE_COUNT] = {
+  [BATTLE] = { battle_load, battle_unload, battle_sword, battle_magic, battle_bow,
+               battle_target_previous, battle_target_next },
+  [TRAVEL] = { travel_load, travel_unload, NULL, travel_open_journey, NULL, NULL, NULL },
+  [WELCOME] = { welcome_load, welcome_unload, welcome_continue, welcome_continue, welcome_continue,
+                NULL, NULL },
+  [DEATH] = { death_load, death_unload, death_continue, death_continue, death_continue, NULL, NULL },
+  [JOURNEY] = { journey_load, journey_unload, journey_close, journey_close, journey_close, NULL, NULL },
+};
+
 void state_transition(int new_state) {
-    if (state == BATTLE) {
-        battle_unload(window);
-    } else if (state == DEATH) {
-        death_unload(window);
-    } else if (state == WELCOME) {
-        welcome_unload(window);
-    } else if (state == TRAVEL) {
-        travel_unload(window);
-    }
+    PROBE_BEGIN();
+    instrument_trace(TRACE_TRANSITION, new_state);
+#ifdef INSTRUMENT
+    uint32_t started = now_ms();
+    size_t used_before = heap_bytes_used();
+    size_t free_before = heap_bytes_free();
+#endif
+    int old_state = state;
+    scenes[state].unload(window);
     state = new_state;
-    persist_write_int(STATE_KEY, state);
+    save_mark_dirty(SAVE_DIRTY_STATE);
+    // runs always start from fresh stats when leaving the welcome screen
+    if (old_state == WELCOME && state == TRAVEL) {
+        journal_record(JOURNAL_NEW_RUN, 0);
+    }
+    scenes[state].load(window);
+    if ((scenes[old_state].on_up_long == NULL) != (scenes[state].on_up_long == NULL) ||
+            (scenes[old_state].on_down_long == NULL) != (scenes[state].on_down_long == NULL)) {
+        window_set_click_config_provider(window, click_config_provider);
+    }
+    // one write covers the new state and anything the scenes changed
+    save_flush();
     //APP_LOG(APP_LOG_LEVEL_DEBUG, "Wrote a state to persistent storage.");
-    if (state == BATTLE) {
-        battle_load(window);
-    } else if (state == DEATH) {
-        death_load(window);
-    } else if (state == WELCOME) {
-        welcome_load(window);
-    } else if (state == TRAVEL) {
-        travel_load(window);
+    if (old_state == BATTLE) {
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Battle used %d flash writes.", battle_flash_writes);
+        instrument_budget("battle_flash_writes", battle_flash_writes, BATTLE_FLASH_WRITE_BUDGET);
     }
+    scene_heap_check();
+    heap_cycle_check();
+#ifdef INSTRUMENT
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Entered state %d in %dms, heap used %d->%d, free %d->%d, high-water %d.",
+            state, (int) (now_ms() - started), (int) used_before, (int) heap_bytes_used(),
+            (int) free_before, (int) heap_bytes_free(), (int) scene_heap[state].high_water);
+#endif
+    instrument_budget("heap_used_bytes", heap_bytes_used(),
+                      heap_bytes_used() + heap_bytes_free() - HEAP_MIN_FREE);
+    PROBE_END(PROBE_STATE_TRANSITION);
+#ifdef INSTRUMENT
+    instrument_budget("transition_ms", instrument_probe(PROBE_STATE_TRANSITION)->last_ms, TRANSITION_BUDGET);
+#endif
 }
 
 static void window_load(Window *window) {
-  if (persist_exists(STATE_KEY)) {
-      state = persist_read_int(STATE_KEY);
-  } else {
-      state = WELCOME;
+  scenes[state].load(window);
+  scene_heap_check();
+  heap_cycle_check();
+  // relaunched into travel with a fight due
+  encounter_check();
+}
+
+static void window_unload(Window *window) {
+  scenes[state].unload(window);
+  // closed on the journey screen
+  if (travel_walking) {
+      travel_end();
   }
-  if (state == BATTLE) {
-      battle_load(window);
-  } else if (state == DEATH) {
-      death_load(window);
-  } else if (state == WELCOME) {
-      welcome_load(window);
-  } else if (state == TRAVEL) {
-      travel_load(window);
+  preload_release();
+
+  if (battle_scene != NULL) {
+      battle_destroy();
+  }
+  if (death_scene != NULL) {
+      death_destroy();
+  }
+  if (welcome_scene != NULL) {
+      welcome_destroy();
+  }
+  if (travel_scene != NULL) {
+      travel_destroy();
+  }
+  if (journey_scene != NULL) {
+      journey_destroy();
   }
 }
 
-static void window_unload(Window *window) {
-  if (state == BATTLE) {
-      battle_unload(window);
-  } else if (state == DEATH) {
-      death_unload(window);
-  } else if (state == WELCOME) {
-      welcome_unload(window);
-  } else if (state == TRAVEL) {
-      travel_unload(window);
+#ifdef JOURNAL_REPLAY
+// Replays the journal from the start of the most recent run through the
+// same handlers that recorded it, stopping if the RNG ever diverges
+static void journal_replay() {
+  journal_load();
+  int oldest = (journal.head + JOURNAL_LENGTH - journal.count) % JOURNAL_LENGTH;
+  int start = -1;
+  for (int i = 0; i < journal.count; i++) {
+      if (journal.entries[(oldest + i) % JOURNAL_LENGTH].type == JOURNAL_NEW_RUN) {
+          start = i;
+      }
+  }
+  if (start < 0) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "Journal does not reach the start of a run.");
+      return;
   }
+
+  journal_replaying = true;
+  journal_replayed = true;
+  state_transition(WELCOME);
+  stats_reset();
+  for (int i = start; i < journal.count; i++) {
+      JournalEntry *entry = &journal.entries[(oldest + i) % JOURNAL_LENGTH];
+      if (i > start && entry->rng != rng_state) {
+          APP_LOG(APP_LOG_LEVEL_ERROR, "Replay diverged at entry %d.", i);
+          break;
+      }
+      rng_state = entry->rng;
+      if (entry->type == JOURNAL_NEW_RUN) {
+          state_transition(TRAVEL);
+      } else if (entry->type == JOURNAL_ENCOUNTER) {
+          state_transition(BATTLE);
+      } else if (entry->type == JOURNAL_PRELOAD) {
+          encounter_preload();
+      } else if (entry->type == JOURNAL_LONG_BUTTON && entry->arg == BUTTON_ID_UP) {
+          up_long_click_handler(NULL, NULL);
+      } else if (entry->type == JOURNAL_LONG_BUTTON) {
+          down_long_click_handler(NULL, NULL);
+      } else if (entry->arg == BUTTON_ID_SELECT) {
+          select_click_handler(NULL, NULL);
+      } else if (entry->arg == BUTTON_ID_UP) {
+          up_click_handler(NULL, NULL);
+      } else if (entry->arg == BUTTON_ID_DOWN) {
+          down_click_handler(NULL, NULL);
+      }
+  }
+  journal_replaying = false;
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Replayed %d journal entries.", journal.count - start);
 }
+#endif
 
 static void init(void) {
-  srand(time(NULL));
-  monster_load();
+  launch_started = now_ms();
   stats_load();
   window = window_create();
   window_set_click_config_provider(window, click_config_provider);
@@ -589,18 +2245,23 @@ static void init(void) {
 }
 
 static void deinit(void) {
+  // closed before the deferred loads ran, they must not be saved over
+  if (!launch_finished) {
+      launch_load();
+  }
   window_destroy(window);
+  resource_cache_clear();
+  save_flush();
+  telemetry_deinit();
 }
 
 int main(void) {
   init();
+#ifdef JOURNAL_REPLAY
+  journal_replay();
+#endif
 
-  if (persist_exists(STATE_KEY)) {
-      //APP_LOG(APP_LOG_LEVEL_DEBUG, "Saved state is %d.", (int)persist_read_int(STATE_KEY));
-  } else {
-      //APP_LOG(APP_LOG_LEVEL_DEBUG, "No saved state found.");
-  }
-
+  //APP_LOG(APP_LOG_LEVEL_DEBUG, "Saved state is %d.", state);
 
   app_event_loop();
   deinit();
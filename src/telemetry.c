@@ -0,0 +1,203 @@
+#include "telemetry.h"
+#include "instrument.h"
+
+// One buffered event
+typedef struct {
+    uint32_t time;              // seconds, from time()
+    uint16_t value;
+    uint8_t type;
+    uint8_t arg;
+} TelemetryEvent;
+
+// Everything in TELEMETRY_PERSIST_KEY, oldest event first
+typedef struct {
+    uint32_t seq;               // number of the next batch
+    uint16_t dropped;           // events lost to a full buffer, not yet reported by a batch
+    // what batch seq reports as dropped, fixed when it is first sent so a
+    // re-send under the same seq says the same
+    uint16_t batch_dropped;
+    uint8_t batch_sent;
+    uint8_t count;
+    uint8_t unused[2];
+    TelemetryEvent events[TELEMETRY_LENGTH];
+} TelemetryBuffer;
+
+// A batch on the wire is a little endian byte array:
+//   uint32 time of the first event, uint16 dropped
+//   then per event: uint8 type, uint8 arg, uint16 value,
+//   uint16 seconds after the first event (saturating)
+#define TELEMETRY_HEADER_BYTES 6
+#define TELEMETRY_EVENT_BYTES 6
+#define TELEMETRY_PAYLOAD_MAX (TELEMETRY_HEADER_BYTES + TELEMETRY_BATCH * TELEMETRY_EVENT_BYTES)
+// Nothing is sent from the phone
+#define TELEMETRY_INBOX_SIZE 64
+
+static TelemetryBuffer buffer;
+// events in the message being sent
+static int in_flight = 0;
+static bool sending = false;
+// AppMessage is only opened by telemetry_open
+static bool opened = false;
+// either the max wait or a retry after a failed send
+static AppTimer *send_timer = NULL;
+static uint32_t retry_delay = 0;
+// buffer.seq as it is in flash
+static uint32_t saved_seq = 0;
+
+static void put16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static int encode(uint8_t *out, int count) {
+    uint32_t base = buffer.events[0].time;
+    put16(out, base);
+    put16(out + 2, base >> 16);
+    put16(out + 4, buffer.batch_dropped);
+    uint8_t *event = out + TELEMETRY_HEADER_BYTES;
+    for (int i = 0; i < count; i++) {
+        uint32_t offset = buffer.events[i].time - base;
+        event[0] = buffer.events[i].type;
+        event[1] = buffer.events[i].arg;
+        put16(event + 2, buffer.events[i].value);
+        put16(event + 4, offset < 0xFFFF ? offset : 0xFFFF);
+        event += TELEMETRY_EVENT_BYTES;
+    }
+    return event - out;
+}
+
+static void timer_fired(void *context);
+
+static void schedule(uint32_t delay) {
+    if (send_timer != NULL) {
+        app_timer_cancel(send_timer);
+    }
+    send_timer = app_timer_register(delay, timer_fired, NULL);
+}
+
+static void back_off() {
+    sending = false;
+    in_flight = 0;
+    retry_delay = retry_delay == 0 ? TELEMETRY_RETRY_MIN : retry_delay * 2;
+    if (retry_delay > TELEMETRY_RETRY_MAX) {
+        retry_delay = TELEMETRY_RETRY_MAX;
+    }
+    schedule(retry_delay);
+}
+
+static void send_batch() {
+    // while backing off only the retry timer may send
+    if (!opened || sending || buffer.count == 0 || (retry_delay != 0 && send_timer != NULL)) {
+        return;
+    }
+    if (send_timer != NULL) {
+        app_timer_cancel(send_timer);
+        send_timer = NULL;
+    }
+    DictionaryIterator *iter;
+    if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+        back_off();
+        return;
+    }
+    if (!buffer.batch_sent) {
+        buffer.batch_dropped = buffer.dropped;
+        buffer.dropped = 0;
+        buffer.batch_sent = true;
+    }
+    uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+    int count = buffer.count < TELEMETRY_BATCH ? buffer.count : TELEMETRY_BATCH;
+    int bytes = encode(payload, count);
+    dict_write_uint32(iter, TELEMETRY_SEQ_KEY, buffer.seq);
+    dict_write_data(iter, TELEMETRY_EVENTS_KEY, payload, bytes);
+    if (app_message_outbox_send() != APP_MSG_OK) {
+        back_off();
+        return;
+    }
+    sending = true;
+    in_flight = count;
+}
+
+static void timer_fired(void *context) {
+    send_timer = NULL;
+    send_batch();
+}
+
+static void outbox_sent(DictionaryIterator *iter, void *context) {
+    buffer.count -= in_flight;
+    memmove(buffer.events, buffer.events + in_flight, buffer.count * sizeof(TelemetryEvent));
+    buffer.batch_dropped = 0;
+    buffer.batch_sent = false;
+    buffer.seq++;
+    sending = false;
+    in_flight = 0;
+    retry_delay = 0;
+    if (buffer.count >= TELEMETRY_BATCH_MIN) {
+        send_batch();
+    } else if (buffer.count > 0) {
+        schedule(TELEMETRY_MAX_WAIT);
+    }
+}
+
+static void outbox_failed(DictionaryIterator *iter, AppMessageResult reason, void *context) {
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Telemetry batch %d failed (%d).", (int) buffer.seq, reason);
+    back_off();
+}
+
+void telemetry_record(TelemetryType type, uint8_t arg, uint16_t value) {
+    if (buffer.count == TELEMETRY_LENGTH) {
+        if (buffer.dropped < 0xFFFF) {
+            buffer.dropped++;
+        }
+        return;
+    }
+    buffer.events[buffer.count++] = (TelemetryEvent) {
+        .time = time(NULL), .value = value, .type = type, .arg = arg
+    };
+    if (buffer.count >= TELEMETRY_BATCH_MIN) {
+        send_batch();
+    } else if (send_timer == NULL && !sending) {
+        schedule(TELEMETRY_MAX_WAIT);
+    }
+}
+
+void telemetry_load() {
+    if (persist_exists(TELEMETRY_PERSIST_KEY)) {
+        TelemetryBuffer saved;
+        instrument_persist_read(sizeof(saved));
+        if (persist_read_data(TELEMETRY_PERSIST_KEY, &saved, sizeof(saved)) != (int) sizeof(saved) ||
+            saved.count > TELEMETRY_LENGTH) {
+            saved = (TelemetryBuffer) { 0 };
+        }
+        // events recorded before this go after the saved ones
+        int kept = buffer.count < TELEMETRY_LENGTH - saved.count ? buffer.count : TELEMETRY_LENGTH - saved.count;
+        memcpy(saved.events + saved.count, buffer.events, kept * sizeof(TelemetryEvent));
+        saved.count += kept;
+        saved.dropped += buffer.dropped + buffer.count - kept;
+        buffer = saved;
+        saved_seq = buffer.seq;
+    }
+}
+
+void telemetry_open() {
+    app_message_register_outbox_sent(outbox_sent);
+    app_message_register_outbox_failed(outbox_failed);
+    app_message_open(TELEMETRY_INBOX_SIZE, dict_calc_buffer_size(2, sizeof(uint32_t), TELEMETRY_PAYLOAD_MAX));
+    opened = true;
+    // leftovers go out as soon as the phone is reachable
+    if (buffer.count > 0) {
+        send_batch();
+    }
+}
+
+void telemetry_deinit() {
+    if (send_timer != NULL) {
+        app_timer_cancel(send_timer);
+        send_timer = NULL;
+    }
+    // a batch still in flight may or may not arrive, the phone skips the
+    // events it already has when it sees the same sequence number again
+    if (buffer.count > 0 || buffer.dropped > 0 || buffer.batch_dropped > 0 || buffer.seq != saved_seq) {
+        persist_write_data(TELEMETRY_PERSIST_KEY, &buffer, sizeof(buffer));
+        instrument_persist_write(sizeof(buffer));
+    }
+}
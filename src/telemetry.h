@@ -0,0 +1,45 @@
+#pragma once
+
+#include <pebble.h>
+
+// Battle, stat and travel events batched up for the phone. Events are
+// buffered in RAM and go out over AppMessage a batch at a time, so the
+// radio wakes up every few minutes instead of on every event.
+
+// Event types, decoded by src/js/pebble-js-app.js
+typedef enum {
+    TELEMETRY_BATTLE_WON,       // arg: enemies in the encounter, value: attacks logged
+    TELEMETRY_DIED,             // arg: monster that landed the blow, value: level reached
+    TELEMETRY_STAT_GAIN,        // arg: stat constant from combat.h, value: new value
+    TELEMETRY_TRAVEL,           // value: steps walked since the travel screen was opened
+} TelemetryType;
+
+// AppMessage keys, matching appKeys in appinfo.json
+#define TELEMETRY_SEQ_KEY 0
+#define TELEMETRY_EVENTS_KEY 1
+
+// Persist key for events that were not sent before the app closed. The
+// keys in legendofxor.c stop below this.
+#define TELEMETRY_PERSIST_KEY 12
+
+// Events buffered on the watch, sized so the buffer fits one
+// persist_write_data call. Once it is full, new events are only counted.
+#define TELEMETRY_LENGTH 30
+// Most events packed into one message
+#define TELEMETRY_BATCH 24
+// A batch is sent once this many events are waiting...
+#define TELEMETRY_BATCH_MIN 12
+// ...or the oldest one has waited this long (in ms)
+#define TELEMETRY_MAX_WAIT (5 * 60 * 1000)
+// Retry delays (in ms) after a failed send, doubling up to the maximum
+#define TELEMETRY_RETRY_MIN 5000
+#define TELEMETRY_RETRY_MAX (10 * 60 * 1000)
+
+// Reloads events left over from the last session. Events recorded before
+// this are kept and sent after them.
+void telemetry_load(void);
+// Opens AppMessage and sends anything left over
+void telemetry_open(void);
+// Saves unsent events and stops any pending send
+void telemetry_deinit(void);
+void telemetry_record(TelemetryType type, uint8_t arg, uint16_t value);
@@ -0,0 +1,593 @@
+/*
+ * Monte Carlo balance simulator for monsters.csv.
+ *
+ *     cc -O2 -pthread tools/balance_sim.c -o balance_sim
+ *     ./balance_sim [-n runs] [-j threads] [-s strategy] [-r seed]
+ *                   [-b max_battles] [-h hit_scales] [-u] [monsters.csv]
+ *
+ * Plays complete runs, from fresh stats to death, with the rules in
+ * src/combat.h and the same order of random draws as random_encounter()
+ * and attack() in src/legendofxor.c. Encounters have one to MAX_ENEMIES
+ * enemies, fought in order without manual retargeting. Health is not
+ * restored between battles and every kill applies the monster's stat
+ * boost, as on the watch. Monsters are picked with the weight_ columns for
+ * the player's level, or uniformly with -u.
+ *
+ * Strategies pick the weapon for each press:
+ *     best    the weapon doing the most damage to this monster
+ *     random  any weapon, uniformly
+ *     sword, magic, bow
+ *                 always that weapon
+ *
+ * Once a player one-shots everything they never take damage again, so runs
+ * are cut short after -b battles (default 1000) and counted as capped.
+ *
+ * -h takes a comma-separated list of percentages applied to every
+ * monster's hit_chance (e.g. 80,100,120); each one is a separate sweep.
+ *
+ * Runs are handed out in chunks of CHUNK_RUNS from a shared counter, so
+ * idle threads keep pulling work until the sweep is done. Each chunk has its
+ * own random stream seeded from (seed, chunk), so results only depend on the
+ * seed and the number of runs, never on the thread count.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/combat.h"
+
+#define MAX_MONSTERS ALIAS_MAX
+#define MAX_TIERS 16
+#define MAX_THREADS 256
+#define CHUNK_RUNS 4096
+
+// Upper limit for -b, and the most presses a battle may take (a monster
+// that resists every weapon can't be killed at 1 damage)
+#define MAX_BATTLES 10000
+#define MAX_PRESSES 1000
+
+// Battle counts at which the stat growth curve is sampled
+static const int growth_points[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+#define GROWTH_POINTS (int) (sizeof(growth_points) / sizeof(growth_points[0]))
+
+enum { STRATEGY_BEST, STRATEGY_RANDOM, STRATEGY_FIXED };
+
+typedef struct {
+    int kind;
+    int weapon;                 // for STRATEGY_FIXED
+} Strategy;
+
+// Tallies for one sweep, kept per thread and merged at the end
+typedef struct {
+    uint64_t runs;
+    uint64_t battles;
+    uint64_t presses;
+    uint64_t capped_runs;
+    uint64_t stalled_battles;
+    uint64_t run_length[MAX_BATTLES + 1];
+    uint64_t encounters[MAX_MONSTERS];
+    uint64_t deaths[MAX_MONSTERS];
+    uint64_t growth_runs[GROWTH_POINTS];
+    uint64_t growth_sum[GROWTH_POINTS][4];   // max health, sword, magic, bow
+} Tally;
+
+typedef struct {
+    int max_health;
+    int sword;
+    int magic;
+    int bow;
+} Player;
+
+static Monster monsters[MAX_MONSTERS];
+static char monster_names[MAX_MONSTERS][64];
+static int monster_count;
+
+// Encounter tiers from the weight_N columns, sorted by the level N they start at
+static int tier_count;
+static int tier_levels[MAX_TIERS];
+static int tier_columns[MAX_TIERS];
+static uint16_t tier_weights[MAX_TIERS][MAX_MONSTERS];
+static AliasTable tier_tables[MAX_TIERS];
+
+// Shared by the workers during a sweep
+static Monster sweep_monsters[MAX_MONSTERS];
+static Strategy strategy;
+static uint64_t sweep_runs;
+static int max_battles = 1000;
+static uint64_t sweep_seed;
+static atomic_uint_fast64_t next_chunk;
+
+static void die(const char *message, const char *detail) {
+    fprintf(stderr, "balance_sim: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+    exit(1);
+}
+
+// splitmix64, used to derive an independent xorshift seed per chunk
+static uint64_t splitmix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static int damage_type(const char *name, int line) {
+    if (strcmp(name, "sword") == 0) {
+        return SWORD_DAMAGE;
+    } else if (strcmp(name, "magic") == 0) {
+        return MAGIC_DAMAGE;
+    } else if (strcmp(name, "bow") == 0) {
+        return BOW_DAMAGE;
+    } else if (strcmp(name, "health") == 0) {
+        return HEALTH_STAT;
+    }
+    fprintf(stderr, "balance_sim: monsters.csv:%d: unknown damage type \"%s\"\n", line, name);
+    exit(1);
+}
+
+// Splits a line on commas in place; returns the number of fields
+static int split(char *line, char **fields, int max) {
+    int count = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    while (count < max) {
+        fields[count++] = line;
+        line = strchr(line, ',');
+        if (line == NULL) {
+            break;
+        }
+        *line++ = '\0';
+    }
+    return count;
+}
+
+// Finds the weight_N columns in the header, or makes one tier of equal
+// weights when there are none
+static void load_tiers(char **fields, int count) {
+    tier_count = 0;
+    for (int f = 0; f < count; f++) {
+        if (strncmp(fields[f], "weight_", 7) != 0) {
+            continue;
+        }
+        if (tier_count == MAX_TIERS) {
+            die("too many weight_ columns", NULL);
+        }
+        // insertion sort by level
+        int level = atoi(fields[f] + 7);
+        int t = tier_count++;
+        for (; t > 0 && tier_levels[t - 1] > level; t--) {
+            tier_levels[t] = tier_levels[t - 1];
+            tier_columns[t] = tier_columns[t - 1];
+        }
+        tier_levels[t] = level;
+        tier_columns[t] = f;
+    }
+    if (tier_count == 0) {
+        tier_count = 1;
+        tier_levels[0] = 0;
+        tier_columns[0] = -1;
+    } else if (tier_levels[0] != 0) {
+        die("the first weight_ column must be weight_0", NULL);
+    }
+}
+
+// Reads monsters.csv the same way wscript does, columns found by header name
+static void load_monsters(const char *path) {
+    enum { NAME, HEALTH, RESISTANCES, HIT_CHANCE, DAMAGE, STAT_BOOST, COLUMNS };
+    static const char *columns[COLUMNS] = {
+        "name", "health", "resistances", "hit_chance", "damage", "stat_boost"
+    };
+    int index[COLUMNS];
+    char line[512];
+    char *fields[32];
+    int have_header = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        die(strerror(errno), path);
+    }
+    for (int number = 1; fgets(line, sizeof(line), file) != NULL; number++) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+        int count = split(line, fields, 32);
+        if (!have_header) {
+            for (int c = 0; c < COLUMNS; c++) {
+                index[c] = -1;
+                for (int f = 0; f < count; f++) {
+                    if (strcmp(fields[f], columns[c]) == 0) {
+                        index[c] = f;
+                    }
+                }
+                if (index[c] < 0) {
+                    die("monsters.csv header is missing a column", columns[c]);
+                }
+            }
+            load_tiers(fields, count);
+            have_header = 1;
+            continue;
+        }
+        if (monster_count == MAX_MONSTERS) {
+            die("too many monsters", NULL);
+        }
+        for (int c = 0; c < COLUMNS; c++) {
+            if (index[c] >= count) {
+                fprintf(stderr, "balance_sim: monsters.csv:%d: missing %s\n", number, columns[c]);
+                exit(1);
+            }
+        }
+        Monster *monster = &monsters[monster_count];
+        snprintf(monster_names[monster_count], sizeof(monster_names[0]), "%s", fields[index[NAME]]);
+        monster->name = monster_names[monster_count];
+        // read wide and range checked first, Monster's fields would wrap
+        int health = atoi(fields[index[HEALTH]]);
+        int hit_chance = atoi(fields[index[HIT_CHANCE]]);
+        int damage = atoi(fields[index[DAMAGE]]);
+        if (health < 1 || damage < 1) {
+            fprintf(stderr, "balance_sim: monsters.csv:%d: health and damage must be at least 1\n", number);
+            exit(1);
+        }
+        if (health > UINT8_MAX || damage > UINT8_MAX) {
+            fprintf(stderr, "balance_sim: monsters.csv:%d: health and damage have to be at most %d\n", number,
+                    UINT8_MAX);
+            exit(1);
+        }
+        if (hit_chance < 0 || hit_chance > 1000) {
+            fprintf(stderr, "balance_sim: monsters.csv:%d: hit_chance is per-mille, between 0 and 1000\n", number);
+            exit(1);
+        }
+        monster->health = health;
+        monster->hit_chance = hit_chance;
+        monster->damage = damage;
+        monster->stat_boost = damage_type(fields[index[STAT_BOOST]], number);
+        monster->resistances = NO_RESISTANCES;
+        if (strcmp(fields[index[RESISTANCES]], "none") != 0) {
+            for (char *r = strtok(fields[index[RESISTANCES]], "|"); r != NULL; r = strtok(NULL, "|")) {
+                monster->resistances |= damage_type(r, number);
+            }
+        }
+        for (int t = 0; t < tier_count; t++) {
+            int weight = tier_columns[t] >= 0 ? atoi(fields[tier_columns[t]]) : 1;
+            if (tier_columns[t] >= count || weight < 0 || weight > 65535) {
+                fprintf(stderr, "balance_sim: monsters.csv:%d: bad weight for level %d\n", number, tier_levels[t]);
+                exit(1);
+            }
+            tier_weights[t][monster_count] = weight;
+        }
+        monster_count++;
+    }
+    fclose(file);
+    if (monster_count == 0) {
+        die("no monsters in", path);
+    }
+}
+
+static int player_weapon(const Player *player, int type) {
+    if (type == SWORD_DAMAGE) {
+        return player->sword;
+    } else if (type == MAGIC_DAMAGE) {
+        return player->magic;
+    }
+    return player->bow;
+}
+
+static int choose_weapon(const Player *player, const Monster *monster, uint32_t *rng) {
+    if (strategy.kind == STRATEGY_FIXED) {
+        return strategy.weapon;
+    } else if (strategy.kind == STRATEGY_RANDOM) {
+        return 1 << combat_scale(combat_xorshift(rng), 3);
+    }
+    int best = SWORD_DAMAGE;
+    for (int type = MAGIC_DAMAGE; type <= BOW_DAMAGE; type <<= 1) {
+        if (combat_damage(player_weapon(player, type), monster, type) >
+            combat_damage(player_weapon(player, best), monster, best)) {
+            best = type;
+        }
+    }
+    return best;
+}
+
+// Mirrors increase_stats()
+static void increase_stats(Player *player, int *health, int attribute) {
+    if (attribute == HEALTH_STAT) {
+        player->max_health += 1;
+        *health += 1;
+    } else if (attribute == SWORD_DAMAGE) {
+        player->sword += 1;
+    } else if (attribute == MAGIC_DAMAGE) {
+        player->magic += 1;
+    } else if (attribute == BOW_DAMAGE) {
+        player->bow += 1;
+    }
+}
+
+// Plays one encounter the way attack() does: the target takes the hit and,
+// once it falls, the next living enemy becomes the target, then every
+// enemy still standing rolls to hit. Returns -1 for a win, the index in
+// monsters of the enemy that killed the player, or -2 when it stalled.
+static int fight(uint32_t *rng, Player *player, int *health, Tally *tally) {
+    int level = combat_level(player->max_health, player->sword + player->magic + player->bow, 3);
+    int tier = 0;
+    while (tier + 1 < tier_count && level >= tier_levels[tier + 1]) {
+        tier++;
+    }
+    int count = 1 + combat_scale(combat_xorshift(rng), MAX_ENEMIES);
+    int index[MAX_ENEMIES];
+    int enemy_health[MAX_ENEMIES];
+    for (int i = 0; i < count; i++) {
+        index[i] = alias_sample(&tier_tables[tier], combat_xorshift(rng));
+        enemy_health[i] = sweep_monsters[index[i]].health;
+        tally->encounters[index[i]]++;
+    }
+    int target = 0;
+    for (int presses = 0; presses < MAX_PRESSES; presses++) {
+        const Monster *monster = &sweep_monsters[index[target]];
+        int type = choose_weapon(player, monster, rng);
+        enemy_health[target] -= combat_damage(player_weapon(player, type), monster, type);
+        tally->presses++;
+        if (enemy_health[target] <= 0) {
+            increase_stats(player, health, monster->stat_boost);
+            int next = 1;
+            while (next < count && enemy_health[(target + next) % count] <= 0) {
+                next++;
+            }
+            if (next == count) {
+                return -1;
+            }
+            target = (target + next) % count;
+        }
+        for (int i = 0; i < count; i++) {
+            const Monster *attacker = &sweep_monsters[index[i]];
+            if (enemy_health[i] <= 0 || !combat_monster_hits(attacker, combat_scale(combat_xorshift(rng), 1000))) {
+                continue;
+            }
+            *health -= attacker->damage;
+            if (*health <= 0) {
+                return index[i];
+            }
+        }
+    }
+    return -2;
+}
+
+// One run from stats_reset() to death
+static void play_run(uint32_t *rng, Tally *tally) {
+    Player player = { START_HEALTH, START_DAMAGE, START_DAMAGE, START_DAMAGE };
+    int health = player.max_health;
+    int battles = 0;
+    int growth = 0;
+    while (battles < max_battles) {
+        int result = fight(rng, &player, &health, tally);
+        if (result >= 0) {
+            tally->deaths[result]++;
+            break;
+        } else if (result == -2) {
+            tally->stalled_battles++;
+            break;
+        }
+        battles++;
+        if (growth < GROWTH_POINTS && battles == growth_points[growth]) {
+            tally->growth_runs[growth]++;
+            tally->growth_sum[growth][0] += player.max_health;
+            tally->growth_sum[growth][1] += player.sword;
+            tally->growth_sum[growth][2] += player.magic;
+            tally->growth_sum[growth][3] += player.bow;
+            growth++;
+        }
+    }
+    if (battles == max_battles) {
+        tally->capped_runs++;
+    }
+    tally->runs++;
+    tally->battles += battles;
+    tally->run_length[battles]++;
+}
+
+static void *worker(void *arg) {
+    Tally *tally = arg;
+    uint64_t chunks = (sweep_runs + CHUNK_RUNS - 1) / CHUNK_RUNS;
+    for (;;) {
+        uint64_t chunk = atomic_fetch_add(&next_chunk, 1);
+        if (chunk >= chunks) {
+            break;
+        }
+        uint32_t rng = (uint32_t) splitmix(sweep_seed ^ splitmix(chunk));
+        if (rng == 0) {
+            rng = 0x2545f491;
+        }
+        uint64_t end = (chunk + 1) * CHUNK_RUNS < sweep_runs ? (chunk + 1) * CHUNK_RUNS : sweep_runs;
+        for (uint64_t run = chunk * CHUNK_RUNS; run < end; run++) {
+            play_run(&rng, tally);
+        }
+    }
+    return NULL;
+}
+
+static void merge(Tally *into, const Tally *from) {
+    into->runs += from->runs;
+    into->battles += from->battles;
+    into->presses += from->presses;
+    into->capped_runs += from->capped_runs;
+    into->stalled_battles += from->stalled_battles;
+    for (int i = 0; i <= MAX_BATTLES; i++) {
+        into->run_length[i] += from->run_length[i];
+    }
+    for (int i = 0; i < monster_count; i++) {
+        into->encounters[i] += from->encounters[i];
+        into->deaths[i] += from->deaths[i];
+    }
+    for (int i = 0; i < GROWTH_POINTS; i++) {
+        into->growth_runs[i] += from->growth_runs[i];
+        for (int s = 0; s < 4; s++) {
+            into->growth_sum[i][s] += from->growth_sum[i][s];
+        }
+    }
+}
+
+// Smallest run length that at least `percent` of runs reached or fell short of
+static int percentile(const Tally *tally, int percent) {
+    uint64_t target = (tally->runs * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i <= max_battles; i++) {
+        seen += tally->run_length[i];
+        if (seen >= target && seen > 0) {
+            return i;
+        }
+    }
+    return max_battles;
+}
+
+static void report(const Tally *tally, int hit_scale, double seconds) {
+    printf("== hit_chance x%d%%: %llu runs in %.2fs (%.0f runs/s)\n", hit_scale,
+           (unsigned long long) tally->runs, seconds, tally->runs / (seconds > 0 ? seconds : 1e-9));
+    printf("battles won per run: mean %.2f, p10 %d, p50 %d, p90 %d, p99 %d, max %d\n",
+           (double) tally->battles / tally->runs, percentile(tally, 10), percentile(tally, 50),
+           percentile(tally, 90), percentile(tally, 99), percentile(tally, 100));
+    printf("presses per battle: %.2f; runs capped at %d battles: %llu; "
+           "runs ended by an unkillable monster: %llu\n",
+           (double) tally->presses / (tally->battles + tally->runs), max_battles,
+           (unsigned long long) tally->capped_runs, (unsigned long long) tally->stalled_battles);
+
+    printf("%-20s %12s %10s %10s\n", "monster", "encounters", "kill rate", "of deaths");
+    uint64_t deaths = 0;
+    for (int i = 0; i < monster_count; i++) {
+        deaths += tally->deaths[i];
+    }
+    for (int i = 0; i < monster_count; i++) {
+        printf("%-20s %12llu %9.2f%% %9.2f%%\n", monsters[i].name,
+               (unsigned long long) tally->encounters[i],
+               tally->encounters[i] ? 100.0 * tally->deaths[i] / tally->encounters[i] : 0.0,
+               deaths ? 100.0 * tally->deaths[i] / deaths : 0.0);
+    }
+
+    printf("%-8s %10s %8s %8s %8s %8s\n", "battles", "reached", "health", "sword", "magic", "bow");
+    for (int i = 0; i < GROWTH_POINTS && tally->growth_runs[i] > 0; i++) {
+        double runs = (double) tally->growth_runs[i];
+        printf("%-8d %9.2f%% %8.2f %8.2f %8.2f %8.2f\n", growth_points[i], 100.0 * runs / tally->runs,
+               tally->growth_sum[i][0] / runs, tally->growth_sum[i][1] / runs,
+               tally->growth_sum[i][2] / runs, tally->growth_sum[i][3] / runs);
+    }
+    printf("\n");
+}
+
+static void parse_strategy(const char *name) {
+    if (strcmp(name, "best") == 0) {
+        strategy.kind = STRATEGY_BEST;
+    } else if (strcmp(name, "random") == 0) {
+        strategy.kind = STRATEGY_RANDOM;
+    } else if (strcmp(name, "sword") == 0 || strcmp(name, "magic") == 0 || strcmp(name, "bow") == 0) {
+        strategy.kind = STRATEGY_FIXED;
+        strategy.weapon = damage_type(name, 0);
+    } else {
+        die("unknown strategy", name);
+    }
+}
+
+static double elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    uint64_t runs = 1000000;
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t seed = 1;
+    const char *hit_scales = "100";
+    int uniform = 0;
+    int opt;
+    parse_strategy("best");
+    while ((opt = getopt(argc, argv, "n:j:s:r:b:h:u")) != -1) {
+        if (opt == 'n') {
+            runs = strtoull(optarg, NULL, 10);
+        } else if (opt == 'j') {
+            threads = atoi(optarg);
+        } else if (opt == 's') {
+            parse_strategy(optarg);
+        } else if (opt == 'r') {
+            seed = strtoull(optarg, NULL, 10);
+        } else if (opt == 'b') {
+            max_battles = atoi(optarg);
+        } else if (opt == 'h') {
+            hit_scales = optarg;
+        } else if (opt == 'u') {
+            uniform = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-n runs] [-j threads] [-s best|random|sword|magic|bow] "
+                            "[-r seed] [-b max_battles] [-h hit_scales] [-u] [monsters.csv]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (max_battles < 1 || max_battles > MAX_BATTLES) {
+        die("max_battles must be between 1 and 10000", NULL);
+    }
+    if (runs == 0) {
+        die("need at least one run", NULL);
+    }
+    load_monsters(optind < argc ? argv[optind] : "monsters.csv");
+    if (uniform) {
+        tier_count = 1;
+        for (int i = 0; i < monster_count; i++) {
+            tier_weights[0][i] = 1;
+        }
+    }
+    for (int t = 0; t < tier_count; t++) {
+        uint32_t total = 0;
+        for (int i = 0; i < monster_count; i++) {
+            total += tier_weights[t][i];
+        }
+        if (total == 0) {
+            fprintf(stderr, "balance_sim: every weight for level %d is 0\n", tier_levels[t]);
+            return 1;
+        }
+        alias_build(&tier_tables[t], tier_weights[t], monster_count);
+    }
+
+    Tally *tallies = malloc(sizeof(Tally) * threads);
+    pthread_t workers[MAX_THREADS];
+    if (tallies == NULL) {
+        die("out of memory", NULL);
+    }
+    for (const char *scale = hit_scales; *scale != '\0'; scale += *scale == ',') {
+        char *end;
+        int percent = (int) strtol(scale, &end, 10);
+        if (end == scale || percent < 0) {
+            die("bad hit_chance scale", scale);
+        }
+        scale = end;
+        for (int i = 0; i < monster_count; i++) {
+            int hit_chance = monsters[i].hit_chance * percent / 100;
+            sweep_monsters[i] = monsters[i];
+            sweep_monsters[i].hit_chance = hit_chance > 1000 ? 1000 : hit_chance;
+        }
+        sweep_runs = runs;
+        sweep_seed = splitmix(seed);
+        atomic_store(&next_chunk, 0);
+        memset(tallies, 0, sizeof(Tally) * threads);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int t = 0; t < threads; t++) {
+            if (pthread_create(&workers[t], NULL, worker, &tallies[t]) != 0) {
+                die("can't start thread", NULL);
+            }
+        }
+        for (int t = 0; t < threads; t++) {
+            pthread_join(workers[t], NULL);
+        }
+        for (int t = 1; t < threads; t++) {
+            merge(&tallies[0], &tallies[t]);
+        }
+        report(&tallies[0], percent, elapsed(&start));
+    }
+    free(tallies);
+    return 0;
+}
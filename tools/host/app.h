@@ -0,0 +1,42 @@
+#pragma once
+
+#include "host.h"
+
+// What the programs in this directory share: the game itself, and how they
+// report their checks.
+
+// The game, unmodified, so its functions and state can be reached
+// directly. Its main() may end without a return, which only main is
+// allowed to do.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#define main legendofxor_main
+#include "legendofxor.c"
+#undef main
+#pragma GCC diagnostic pop
+
+// The word result lines start with, define it before including this
+#ifndef APP_RESULT_KIND
+#define APP_RESULT_KIND "test"
+#endif
+
+// Checks that failed, programs exit non-zero when there are any
+static int failures = 0;
+
+// Prints one "test name=... value=... limit=... result=ok|FAIL" line,
+// labels are extra key=value pairs. value must not be above limit.
+static inline void result(const char *name, const char *labels, long long value, long long limit) {
+    bool ok = value <= limit;
+    failures += !ok;
+    printf(APP_RESULT_KIND " name=%s%s%s value=%lld limit=%lld result=%s\n", name,
+           labels[0] != '\0' ? " " : "", labels, value, limit, ok ? "ok" : "FAIL");
+}
+
+// Prints one "test name=... value=... expected=... result=ok|FAIL" line,
+// value must be exactly what was expected
+static inline void expect(const char *name, long long value, long long expected) {
+    bool ok = value == expected;
+    failures += !ok;
+    printf(APP_RESULT_KIND " name=%s value=%lld expected=%lld result=%s\n", name, value, expected,
+           ok ? "ok" : "FAIL");
+}
@@ -0,0 +1,334 @@
+/*
+ * Benchmarks the game's hot paths on the stub SDK, built with INSTRUMENT:
+ *
+ *     make -C tools/host bench
+ *     tools/host/build/legendofxor_bench [trace.csv ...]
+ *
+ * Runs startup, stats_load(), attack() for every weapon against every
+ * monster, query_accel() over synthetic and recorded accelerometer traces,
+ * and whole WELCOME -> TRAVEL -> BATTLE -> DEATH -> WELCOME cycles.
+ *
+ * Every result is a line like
+ *
+ *     bench name=attack_host_ns monster=0 weapon=sword value=512 limit=20000 result=ok
+ *
+ * value is checked against limit, lower is better. Results end in host_ns
+ * (real time on this machine), watch_ms (virtual time, which includes the
+ * stub's modeled PERSIST_WRITE_COST and BITMAP_LOAD_COST) or a count. The
+ * game's own budget checks (instrument_budget) are summed up as
+ * "budget" lines. The run exits non-zero when anything failed.
+ */
+
+#include <time.h>
+#define APP_RESULT_KIND "bench"
+#include "app.h"
+#include "trace.h"
+
+// Repetitions
+#define BENCH_STATS_LOADS 1000
+#define BENCH_ATTACKS 200           // per weapon and monster
+#define BENCH_CYCLES 100
+#define BENCH_WALK_STEPS 5000
+#define BENCH_STILL_HOURS 2
+#define BENCH_MAX_SAMPLES (BENCH_WALK_STEPS * TRACE_STEP_SAMPLES)
+#define BENCH_MAX_PRESSES 500
+
+// Limits on real time, far above what a desktop needs so only a change in
+// complexity trips them
+#define BENCH_STATS_LOAD_NS 20000
+#define BENCH_ATTACK_NS 20000
+#define BENCH_QUERY_ACCEL_NS 50000    // per batch of ACCEL_BATCH_SIZE samples
+#define BENCH_TRANSITION_NS 500000
+// stats_load() and attack() alone must not touch flash
+#define BENCH_STATS_LOAD_WRITES 0
+// Walking checkpoints the save and the journey every TRAVEL_CHECKPOINT_STEPS.
+// Each encounter it starts writes both again, and its journal entry.
+#define BENCH_WALK_WRITES (2 * BENCH_WALK_STEPS / TRAVEL_CHECKPOINT_STEPS + 3 * BENCH_WALK_STEPS / ENCOUNTER_STEPS)
+// Steps the detector may miss or add, in percent of those walked
+#define BENCH_STEP_ERROR 5
+// Accelerometer batches and probes per hour of lying still
+#define BENCH_STILL_WAKEUPS 120
+// One save per transition, and the journal entry that starts a new run
+#define BENCH_CYCLE_WRITES 5
+
+typedef struct {
+    uint32_t count;
+    uint64_t host_ns;
+    uint64_t host_ns_max;
+    uint32_t watch_ms_max;
+} Timing;
+
+// A check of the game's own, from instrument_budget(). Limits can differ
+// between checks of the same name, the one closest to its limit is kept.
+typedef struct {
+    char name[32];
+    uint32_t checks;
+    int value;
+    int limit;
+    uint32_t failures;
+} Budget;
+
+#define BENCH_MAX_BUDGETS 16
+
+// One run through the game, from the welcome screen back to it
+static const int cycle[] = { TRAVEL, BATTLE, DEATH, WELCOME };
+#define CYCLE_LENGTH ((int) (sizeof(cycle) / sizeof(cycle[0])))
+
+static const char *weapon_names[WEAPON_COUNT] = { "sword", "magic", "bow" };
+static const char *state_names[STATE_COUNT] = { "battle", "travel", "welcome", "death", "journey" };
+
+static Budget budgets[BENCH_MAX_BUDGETS];
+static int budget_count = 0;
+static int trace_count = 0;
+static char **trace_paths = NULL;
+// Collects the cost of accelerometer batches while set
+static Timing *accel_timing = NULL;
+static AccelData samples[BENCH_MAX_SAMPLES];
+
+static uint64_t clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void timing_add(Timing *timing, uint64_t host_ns, uint32_t watch_ms) {
+    timing->count++;
+    timing->host_ns += host_ns;
+    timing->host_ns_max = host_ns > timing->host_ns_max ? host_ns : timing->host_ns_max;
+    timing->watch_ms_max = watch_ms > timing->watch_ms_max ? watch_ms : timing->watch_ms_max;
+}
+
+static uint64_t timing_avg(const Timing *timing) {
+    return timing->count > 0 ? timing->host_ns / timing->count : 0;
+}
+
+// Picks up the "budget name=... value=... limit=... result=..." lines
+static void log_budget(uint8_t level, const char *message) {
+    char name[32];
+    int value, limit;
+    if (sscanf(message, "budget name=%31s value=%d limit=%d", name, &value, &limit) != 3) {
+        return;
+    }
+    Budget *budget = NULL;
+    for (int i = 0; i < budget_count && budget == NULL; i++) {
+        budget = strcmp(budgets[i].name, name) == 0 ? &budgets[i] : NULL;
+    }
+    if (budget == NULL && budget_count < BENCH_MAX_BUDGETS) {
+        budget = &budgets[budget_count++];
+        snprintf(budget->name, sizeof(budget->name), "%s", name);
+        budget->value = value;
+        budget->limit = limit;
+    }
+    if (budget == NULL) {
+        return;
+    }
+    budget->checks++;
+    if ((long long) value - limit > (long long) budget->value - budget->limit) {
+        budget->value = value;
+        budget->limit = limit;
+    }
+    budget->failures += value > limit;
+}
+
+static void event_cost(HostEvent event, int arg, uint64_t host_ns, uint32_t watch_ms) {
+    if (event == HOST_EVENT_ACCEL && accel_timing != NULL) {
+        timing_add(accel_timing, host_ns, watch_ms);
+    }
+}
+
+// Presses through a fight with the weapon doing the most damage, and back
+// to travel if it was lost
+static void fight() {
+    for (int presses = 0; state == BATTLE && presses < BENCH_MAX_PRESSES; presses++) {
+        int best = WEAPON_SWORD;
+        for (int i = 0; i < WEAPON_COUNT; i++) {
+            best = damage_matrix[target][i] > damage_matrix[target][best] ? i : best;
+        }
+        host_click(best == WEAPON_SWORD ? BUTTON_ID_UP : best == WEAPON_MAGIC ? BUTTON_ID_SELECT : BUTTON_ID_DOWN);
+    }
+    while (state == DEATH || state == WELCOME) {
+        host_click(BUTTON_ID_SELECT);
+    }
+}
+
+// Heap held outside the cache by anything but the retained scenes
+static int heap_outside_scenes() {
+    int used = heap_outside_cache();
+    for (int i = 0; i < STATE_COUNT; i++) {
+        used -= scene_heap[i].built;
+    }
+    return used;
+}
+
+static void bench_cycles() {
+    Timing timings[STATE_COUNT] = { { 0 } };
+    if (state != WELCOME) {
+        state_transition(WELCOME);
+    }
+    host_run(HOST_CLICK_MS);
+    int heap_started = heap_outside_scenes();
+    uint32_t writes = host_stats()->persist_writes;
+    for (int i = 0; i < BENCH_CYCLES; i++) {
+        for (int step = 0; step < CYCLE_LENGTH; step++) {
+            uint64_t started = clock_ns();
+            uint64_t watch_started = host_time_ms();
+            // the way attack() loses a battle
+            if (cycle[step] == DEATH) {
+                clear_stats();
+            }
+            state_transition(cycle[step]);
+            timing_add(&timings[cycle[step]], clock_ns() - started, host_time_ms() - watch_started);
+            host_run(HOST_CLICK_MS);
+        }
+    }
+    for (int step = 0; step < CYCLE_LENGTH; step++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "to=%s", state_names[cycle[step]]);
+        result("transition_host_ns", labels, timing_avg(&timings[cycle[step]]), BENCH_TRANSITION_NS);
+        result("transition_watch_ms_max", labels, timings[cycle[step]].watch_ms_max, TRANSITION_BUDGET);
+    }
+    result("cycle_flash_writes", "", (host_stats()->persist_writes - writes) / BENCH_CYCLES, BENCH_CYCLE_WRITES);
+    result("cycle_heap_growth_bytes", "", heap_outside_scenes() - heap_started, 0);
+}
+
+static void bench_stats_load() {
+    Timing timing = { 0 };
+    uint32_t writes = host_stats()->persist_writes;
+    for (int i = 0; i < BENCH_STATS_LOADS; i++) {
+        uint64_t started = clock_ns();
+        uint64_t watch_started = host_time_ms();
+        stats_load();
+        timing_add(&timing, clock_ns() - started, host_time_ms() - watch_started);
+    }
+    result("stats_load_host_ns", "", timing_avg(&timing), BENCH_STATS_LOAD_NS);
+    result("stats_load_flash_writes", "", host_stats()->persist_writes - writes, BENCH_STATS_LOAD_WRITES);
+}
+
+// Walks away from a battle that is still going
+static void battle_leave() {
+    state_transition(TRAVEL);
+    battle_arena_reset();
+    host_run(HOST_CLICK_MS);
+}
+
+// A fresh battle against one monster at full health
+static void battle_enter(int monster) {
+    if (state != TRAVEL) {
+        battle_leave();
+    }
+    stats_reset();
+    encounter_start(1);
+    enemies[0] = (Enemy) { .monster = monster, .health = monster_index[monster].health };
+    state_transition(BATTLE);
+    host_run(HOST_CLICK_MS);
+}
+
+static void bench_attacks() {
+    // warm up: the battle scene is built and kept from here on
+    battle_enter(0);
+    battle_leave();
+    int heap_started = heap_outside_scenes();
+    for (int monster = 0; monster < MONSTER_COUNT; monster++) {
+        for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+            Timing timing = { 0 };
+            for (int i = 0; i < BENCH_ATTACKS; i++) {
+                if (state != BATTLE) {
+                    battle_enter(monster);
+                }
+                uint64_t started = clock_ns();
+                uint64_t watch_started = host_time_ms();
+                attack(weapon);
+                timing_add(&timing, clock_ns() - started, host_time_ms() - watch_started);
+                // deferred saves and redraws, as between two presses
+                host_run(HOST_CLICK_MS);
+            }
+            char labels[32];
+            snprintf(labels, sizeof(labels), "monster=%d weapon=%s", monster, weapon_names[weapon]);
+            result("attack_host_ns", labels, timing_avg(&timing), BENCH_ATTACK_NS);
+            // includes the transition when the battle ends
+            result("attack_watch_ms_max", labels, timing.watch_ms_max, TRANSITION_BUDGET);
+        }
+    }
+    battle_leave();
+    result("attack_heap_growth_bytes", "", heap_outside_scenes() - heap_started, 0);
+}
+
+// Plays samples in travel a batch at a time, fighting whatever turns up
+static void walk(const AccelData *trace, int count, Timing *timing, uint32_t *writes) {
+    int chunk = ACCEL_BATCH_SIZE;
+    for (int played = 0; played < count; played += chunk) {
+        uint32_t writes_before = host_stats()->persist_writes;
+        accel_timing = timing;
+        host_accel_play(trace + played, count - played < chunk ? count - played : chunk);
+        accel_timing = NULL;
+        *writes += host_stats()->persist_writes - writes_before;
+        fight();
+    }
+}
+
+static void bench_walks() {
+    if (state != TRAVEL) {
+        state_transition(TRAVEL);
+    }
+    Timing timing = { 0 };
+    uint32_t writes = 0;
+    uint32_t steps = journey_log.total_steps;
+    walk(samples, trace_walk(samples, BENCH_MAX_SAMPLES, BENCH_WALK_STEPS, 1), &timing, &writes);
+    int counted = journey_log.total_steps - steps;
+    result("query_accel_host_ns", "trace=walk", timing_avg(&timing), BENCH_QUERY_ACCEL_NS);
+    result("query_accel_watch_ms_max", "trace=walk", timing.watch_ms_max, TRANSITION_BUDGET);
+    result("walk_flash_writes", "trace=walk", writes, BENCH_WALK_WRITES);
+    result("step_error_percent", "trace=walk", abs(counted - BENCH_WALK_STEPS) * 100 / BENCH_WALK_STEPS,
+           BENCH_STEP_ERROR);
+
+    for (int i = 0; i < trace_count; i++) {
+        int count = trace_load(trace_paths[i], samples, BENCH_MAX_SAMPLES);
+        if (count < 0) {
+            fprintf(stderr, "can't read %s\n", trace_paths[i]);
+            failures++;
+            continue;
+        }
+        Timing recorded = { 0 };
+        uint32_t recorded_writes = 0;
+        char labels[300];
+        snprintf(labels, sizeof(labels), "trace=%s", trace_paths[i]);
+        walk(samples, count, &recorded, &recorded_writes);
+        result("query_accel_host_ns", labels, timing_avg(&recorded), BENCH_QUERY_ACCEL_NS);
+        result("query_accel_watch_ms_max", labels, recorded.watch_ms_max, TRANSITION_BUDGET);
+    }
+
+    // lying still, the detector should back off to occasional probes
+    uint32_t wakeups = accel_wakeups;
+    host_accel_play(samples, trace_still(samples, BENCH_MAX_SAMPLES, 100, 1));
+    host_run(BENCH_STILL_HOURS * 3600 * 1000);
+    result("still_wakeups_per_hour", "", (accel_wakeups - wakeups) / BENCH_STILL_HOURS, BENCH_STILL_WAKEUPS);
+}
+
+static void driver() {
+    bench_cycles();
+    bench_stats_load();
+    bench_attacks();
+    bench_walks();
+}
+
+int main(int argc, char **argv) {
+    trace_paths = argv + 1;
+    trace_count = argc - 1;
+    host_set_log_hook(log_budget);
+    host_set_event_hook(event_cost);
+    host_set_driver(driver);
+    // launch budgets are checked by the game itself as it starts
+    legendofxor_main();
+
+    for (int i = 0; i < budget_count; i++) {
+        Budget *budget = &budgets[i];
+        printf("budget name=%s checks=%u value=%d limit=%d failures=%u result=%s\n", budget->name,
+               (unsigned) budget->checks, budget->value, budget->limit, (unsigned) budget->failures,
+               budget->failures == 0 ? "ok" : "FAIL");
+        failures += budget->failures > 0;
+    }
+    const HostStats *stats = host_stats();
+    result("host_errors", "", stats->errors, 0);
+    result("heap_high_water_bytes", "", stats->heap_high_water, HOST_HEAP_SIZE);
+    return failures > 0;
+}
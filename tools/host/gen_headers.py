@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#
+# Writes the headers the Pebble SDK would generate, for the host build:
+#
+#     gen_headers.py <build dir>
+#
+#   src/monsters.auto.h       by the same rules wscript runs
+#   src/weapon_atlas.auto.h
+#   src/resource_ids.auto.h   RESOURCE_ID_* numbered in appinfo.json order
+#   host_resources.auto.h     each resource's type, size and dimensions
+#
+# Bitmap sizes come from the PNG headers, font sizes from the file.
+
+import json
+import os
+import struct
+import sys
+from importlib.machinery import SourceFileLoader
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..')
+
+class Node(object):
+    # The part of a waf node that wscript's rules use
+    def __init__(self, path):
+        self.path = path
+        self.name = os.path.basename(path)
+
+    def read(self, flags='r'):
+        with open(self.path, flags) as f:
+            return f.read()
+
+    def write(self, text):
+        with open(self.path, 'w') as f:
+            f.write(text)
+
+class Task(object):
+    def __init__(self, inputs, outputs):
+        self.inputs = [Node(p) for p in inputs]
+        self.outputs = [Node(p) for p in outputs]
+
+def png_size(path):
+    with open(path, 'rb') as f:
+        header = f.read(24)
+    if header[:8] != b'\x89PNG\r\n\x1a\n':
+        raise ValueError('%s is not a PNG' % path)
+    return struct.unpack('>II', header[16:24])
+
+def write_if_changed(path, text):
+    # keeps make from rebuilding everything when nothing changed
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return
+    with open(path, 'w') as f:
+        f.write(text)
+
+def generate(build, rule, inputs, name):
+    # runs a wscript rule into a temporary file, keeping the header if it is unchanged
+    output = os.path.join(build, 'src', name + '.tmp')
+    rule(Task(inputs, [output]))
+    with open(output) as f:
+        write_if_changed(os.path.join(build, 'src', name), f.read())
+    os.remove(output)
+
+def main(build):
+    os.makedirs(os.path.join(build, 'src'), exist_ok=True)
+    wscript = SourceFileLoader('wscript', os.path.join(ROOT, 'wscript')).load_module()
+    appinfo = os.path.join(ROOT, 'appinfo.json')
+
+    generate(build, wscript.generate_monster_table, [os.path.join(ROOT, 'monsters.csv'), appinfo],
+             'monsters.auto.h')
+    generate(build, wscript.generate_weapon_atlas,
+             [os.path.join(ROOT, 'resources', icon) for icon in wscript.WEAPON_ICONS + [wscript.WEAPON_ICON_ATLAS]],
+             'weapon_atlas.auto.h')
+
+    with open(appinfo) as f:
+        media = json.load(f)['resources']['media']
+    ids = ['// Generated from appinfo.json by tools/host/gen_headers.py, do not edit.',
+           'typedef enum {',
+           '    INVALID_RESOURCE = 0,']
+    resources = ['// Generated from appinfo.json by tools/host/gen_headers.py, do not edit.',
+                 'static const HostResource host_resources[] = {']
+    for number, resource in enumerate(media, 1):
+        path = os.path.join(ROOT, 'resources', resource['file'])
+        is_font = resource['type'] == 'font'
+        width, height = (0, 0) if is_font else png_size(path)
+        ids.append('    RESOURCE_ID_%s = %d,' % (resource['name'], number))
+        resources.append('    { RESOURCE_ID_%s, "%s", %s, %d, %d, %d },' % (
+            resource['name'], resource['name'], 'true' if is_font else 'false', width, height,
+            os.path.getsize(path)))
+    ids += ['} AppResourceId;', '']
+    resources += ['};', '']
+    write_if_changed(os.path.join(build, 'src', 'resource_ids.auto.h'), '\n'.join(ids))
+    write_if_changed(os.path.join(build, 'host_resources.auto.h'), '\n'.join(resources))
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit('usage: gen_headers.py <build dir>')
+    main(sys.argv[1])
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <pebble.h>
+
+// Drives the stub SDK in pebble.c: a virtual clock, scripted presses and
+// accelerometer samples, the phone end of AppMessage, and counters for
+// everything the app did. Mistakes the watch would crash on or silently
+// get wrong (drawing a destroyed bitmap, cancelling a timer that already
+// fired, oversized persist writes, ...) are logged and counted as errors.
+
+// Where the virtual clock starts, in seconds since the epoch
+#define HOST_EPOCH 1400000000
+
+// How long a press is held before release, and a long press. Single clicks
+// on a button that also has a long click subscribed only fire on release.
+#define HOST_CLICK_MS 100
+#define HOST_LONG_CLICK_MS 600
+
+// ms between an outbox send and the phone's reply
+#define HOST_APP_MESSAGE_LATENCY 200
+
+// Bytes of app heap, and the overhead the allocator adds to every block
+#define HOST_HEAP_SIZE 12288
+#define HOST_HEAP_OVERHEAD 8
+
+// What the phone does with the messages it is sent
+typedef enum {
+    HOST_REPLY_ACK,
+    HOST_REPLY_NACK,
+    HOST_REPLY_TIMEOUT,
+    HOST_REPLY_DISCONNECTED,
+} HostReply;
+
+// One message the phone received
+typedef struct {
+    uint8_t bytes[1024];        // the dictionary as it went over the air
+    uint32_t size;
+    uint64_t sent_ms;           // host_time_ms() when it was sent
+    HostReply reply;
+} HostMessage;
+
+// Events the stub hands to the app
+typedef enum {
+    HOST_EVENT_CLICK,
+    HOST_EVENT_LONG_CLICK,
+    HOST_EVENT_ACCEL,
+    HOST_EVENT_TAP,
+    HOST_EVENT_TIMER,
+    HOST_EVENT_APP_MESSAGE,
+    HOST_EVENT_RENDER,
+    HOST_EVENT_COUNT
+} HostEvent;
+
+// Called after every event with its real cost on this machine and its
+// modeled cost on the watch (virtual ms spent in it)
+typedef void (*HostEventHook)(HostEvent event, int arg, uint64_t host_ns, uint32_t watch_ms);
+typedef void (*HostLogHook)(uint8_t level, const char *message);
+
+typedef struct {
+    uint32_t events[HOST_EVENT_COUNT];
+    uint32_t persist_reads;
+    uint32_t persist_writes;
+    uint32_t persist_bytes_written;
+    uint32_t bitmap_loads;
+    uint32_t vibes;
+    uint32_t accel_samples;     // delivered to the app
+    uint32_t accel_peeks;
+    uint32_t clicks_on_release; // single clicks held back by a long click subscription
+    uint32_t frames;
+    uint32_t errors;
+    uint32_t warnings;          // APP_LOG warnings and errors from the app
+    size_t heap_high_water;
+} HostStats;
+
+// Everything drawn in one frame
+struct GContext {
+    GColor fill_color;
+    uint32_t fill_rects;
+    GRect last_fill;
+    uint32_t bitmaps;
+    uint32_t texts;
+};
+
+// Runs driver in place of app_event_loop(). Without one the loop only
+// settles (draws, runs due timers) and returns, like an app closed at once.
+void host_set_driver(void (*driver)(void));
+
+// Virtual ms since the epoch
+uint64_t host_time_ms(void);
+void host_set_time(time_t seconds);
+// Lets ms pass, running timers and streaming the held accelerometer sample
+void host_run(uint32_t ms);
+
+void host_click(ButtonId button);
+void host_long_click(ButtonId button);
+
+// Plays samples at the subscribed rate; the last one is held afterwards
+void host_accel_play(const AccelData *samples, int count);
+void host_accel_hold(AccelData sample);
+void host_tap(AccelAxisType axis, int32_t direction);
+void host_set_battery(uint8_t percent, bool charging);
+
+// The phone's reply to every message from now on
+void host_set_reply(HostReply reply);
+int host_message_count(void);
+const HostMessage* host_message(int index);
+// Finds a tuple in a received message, false when it isn't there
+bool host_message_tuple(const HostMessage *message, uint32_t key, const uint8_t **data, uint16_t *length);
+
+// Flash, so a run can be continued in a later process
+bool host_persist_save(const char *path);
+bool host_persist_load(const char *path);
+void host_persist_clear(void);
+// Writes to a key since launch, or since it was last deleted
+uint32_t host_persist_writes(uint32_t key);
+
+void host_set_heap_size(size_t bytes);
+// Log app messages at or below this level to stderr, 0 for none
+void host_set_log_level(uint8_t level);
+void host_set_log_hook(HostLogHook hook);
+void host_set_event_hook(HostEventHook hook);
+
+const HostStats* host_stats(void);
+// A frame drawn the way the app's root window would be drawn now
+GContext* host_render(void);
+// A context for calling update procs directly
+GContext* host_graphics_context(void);
+// Logs and counts a mistake in how the app used the SDK
+void host_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
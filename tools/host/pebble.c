@@ -0,0 +1,1237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include "host.h"
+
+// Resources from appinfo.json with the sizes the watch would see
+typedef struct {
+    uint32_t id;
+    const char *name;
+    bool is_font;
+    int16_t width;
+    int16_t height;
+    uint32_t size;              // bytes in the resource pack
+} HostResource;
+
+// host_resources[], written by gen_headers.py
+#include "host_resources.auto.h"
+
+// Heap each SDK object takes on the watch, on top of HOST_HEAP_OVERHEAD
+#define HOST_WINDOW_BYTES 100
+#define HOST_LAYER_BYTES 36
+#define HOST_TEXT_LAYER_BYTES 72
+#define HOST_BITMAP_LAYER_BYTES 48
+#define HOST_GBITMAP_BYTES 20
+#define HOST_FONT_BYTES 24
+
+// Bytes of flash an app may use across all its keys
+#define HOST_PERSIST_STORAGE 4096
+#define HOST_PERSIST_KEYS 64
+
+#define HOST_DISPLAY_WIDTH 144
+#define HOST_DISPLAY_HEIGHT 152
+
+// Sampling rate the accelerometer streams at until the app picks one
+#define HOST_ACCEL_DEFAULT_RATE ACCEL_SAMPLING_25HZ
+#define HOST_ACCEL_MAX_BATCH 25
+
+// How long each vibe keeps flagging samples with did_vibrate
+#define HOST_VIBE_SHORT_MS 200
+#define HOST_VIBE_LONG_MS 500
+#define HOST_VIBE_DOUBLE_MS 400
+
+typedef enum {
+    LAYER_PLAIN,
+    LAYER_TEXT,
+    LAYER_BITMAP,
+    LAYER_ROOT,
+} LayerKind;
+
+// Headers of destroyed objects are never freed, only marked dead, so
+// anything still pointing at one can be caught instead of reading garbage
+struct Layer {
+    bool live;
+    LayerKind kind;
+    GRect frame;
+    bool hidden;
+    LayerUpdateProc update_proc;
+    Layer *parent;
+    Layer *first_child;
+    Layer *next_sibling;
+};
+
+struct TextLayer {
+    Layer layer;
+    const char *text;
+    GFont font;
+    GTextAlignment alignment;
+};
+
+struct BitmapLayer {
+    Layer layer;
+    const GBitmap *bitmap;
+};
+
+struct Window {
+    bool live;
+    Layer root;
+    WindowHandlers handlers;
+    ClickConfigProvider click_config_provider;
+    bool loaded;
+};
+
+struct FontInfo {
+    bool live;
+    bool system;
+};
+
+typedef struct HostBitmap {
+    GBitmap bitmap;
+    bool live;
+    const struct HostBitmap *parent;    // for sub-bitmaps, which share its pixels
+    size_t heap;
+} HostBitmap;
+
+typedef struct HostTimer {
+    uint32_t id;
+    uint64_t due;
+    AppTimerCallback callback;
+    void *data;
+    bool reply;                 // the phone answering an outbox send
+    struct HostTimer *next;
+} HostTimer;
+
+typedef struct {
+    ClickHandler single;
+    ClickHandler long_down;
+    ClickHandler long_up;
+} ClickConfig;
+
+typedef struct {
+    bool used;
+    uint32_t key;
+    uint16_t size;
+    uint32_t writes;            // since launch
+    uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistEntry;
+
+struct DictionaryIterator {
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t used;
+};
+
+static uint64_t clock_ms = (uint64_t) HOST_EPOCH * 1000;
+static void (*driver)(void) = NULL;
+static HostStats stats;
+static HostEventHook event_hook = NULL;
+static HostLogHook log_hook = NULL;
+static uint8_t log_level = 0;
+
+static size_t heap_size = HOST_HEAP_SIZE;
+static size_t heap_used = 0;
+
+static Window *top_window = NULL;
+static bool needs_redraw = false;
+static GContext frame;
+static GContext scratch;
+static struct FontInfo system_font = { .live = true, .system = true };
+
+static ClickConfig clicks[NUM_BUTTONS];
+static bool configuring_clicks = false;
+
+static HostTimer *timers = NULL;
+static uint32_t timer_ids = 0;
+
+static bool accel_subscribed = false;
+static uint32_t accel_batch = 0;
+static AccelDataHandler accel_handler = NULL;
+static AccelSamplingRate accel_rate = HOST_ACCEL_DEFAULT_RATE;
+static uint64_t accel_next_ms = 0;
+static AccelData accel_held = { .z = -1000 };
+static AccelData accel_buffer[HOST_ACCEL_MAX_BATCH];
+static uint32_t accel_fill = 0;
+static AccelTapHandler tap_handler = NULL;
+static uint64_t vibe_until = 0;
+static BatteryChargeState battery = { .charge_percent = 80 };
+
+static PersistEntry persist[HOST_PERSIST_KEYS];
+
+static bool app_message_opened = false;
+static uint8_t *outbox = NULL;
+static DictionaryIterator outbox_iter;
+static bool outbox_begun = false;
+static bool outbox_busy = false;
+static AppMessageOutboxSent sent_callback = NULL;
+static AppMessageOutboxFailed failed_callback = NULL;
+static HostReply reply_policy = HOST_REPLY_ACK;
+static HostMessage *messages = NULL;
+static int message_count = 0;
+static int message_capacity = 0;
+
+void host_error(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "host: error: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    stats.errors++;
+}
+
+// Heap
+
+static bool heap_take(size_t bytes) {
+    bytes += HOST_HEAP_OVERHEAD;
+    if (heap_used + bytes > heap_size) {
+        return false;
+    }
+    heap_used += bytes;
+    if (heap_used > stats.heap_high_water) {
+        stats.heap_high_water = heap_used;
+    }
+    return true;
+}
+
+static void heap_give(size_t bytes) {
+    heap_used -= bytes + HOST_HEAP_OVERHEAD;
+}
+
+size_t heap_bytes_used(void) {
+    return heap_used;
+}
+
+size_t heap_bytes_free(void) {
+    return heap_size - heap_used;
+}
+
+void host_set_heap_size(size_t bytes) {
+    heap_size = bytes;
+}
+
+// Events
+
+static uint64_t host_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+typedef struct {
+    uint64_t ns;
+    uint64_t clock;
+} Dispatch;
+
+static Dispatch dispatch_begin(void) {
+    return (Dispatch) { .ns = host_ns(), .clock = clock_ms };
+}
+
+static void dispatch_end(HostEvent event, int arg, Dispatch started) {
+    uint64_t ns = host_ns() - started.ns;
+    stats.events[event]++;
+    if (event_hook != NULL) {
+        event_hook(event, arg, ns, clock_ms - started.clock);
+    }
+}
+
+void host_set_event_hook(HostEventHook hook) {
+    event_hook = hook;
+}
+
+void host_set_driver(void (*run)(void)) {
+    driver = run;
+}
+
+// Drawing
+
+static bool layer_check(const Layer *layer, const char *caller) {
+    if (layer == NULL || !layer->live) {
+        host_error("%s on a destroyed layer", caller);
+        return false;
+    }
+    return true;
+}
+
+static bool bitmap_live(const GBitmap *bitmap) {
+    const HostBitmap *host = (const HostBitmap*) bitmap;
+    return host->live && (host->parent == NULL || host->parent->live);
+}
+
+static void draw_layer(Layer *layer, GContext *ctx) {
+    if (layer->hidden) {
+        return;
+    }
+    if (layer->update_proc != NULL) {
+        layer->update_proc(layer, ctx);
+    }
+    if (layer->kind == LAYER_TEXT) {
+        TextLayer *text_layer = (TextLayer*) layer;
+        if (text_layer->font != NULL && !text_layer->font->live) {
+            host_error("text layer draws with an unloaded font");
+        }
+        ctx->texts += text_layer->text != NULL;
+    } else if (layer->kind == LAYER_BITMAP) {
+        const GBitmap *bitmap = ((BitmapLayer*) layer)->bitmap;
+        if (bitmap != NULL && !bitmap_live(bitmap)) {
+            host_error("bitmap layer draws a destroyed bitmap");
+        } else if (bitmap != NULL) {
+            ctx->bitmaps++;
+        }
+    }
+    for (Layer *child = layer->first_child; child != NULL; child = child->next_sibling) {
+        draw_layer(child, ctx);
+    }
+}
+
+GContext* host_render(void) {
+    memset(&frame, 0, sizeof(frame));
+    needs_redraw = false;
+    if (top_window == NULL) {
+        return &frame;
+    }
+    Dispatch started = dispatch_begin();
+    draw_layer(&top_window->root, &frame);
+    stats.frames++;
+    dispatch_end(HOST_EVENT_RENDER, 0, started);
+    return &frame;
+}
+
+GContext* host_graphics_context(void) {
+    memset(&scratch, 0, sizeof(scratch));
+    return &scratch;
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+    ctx->fill_color = color;
+}
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+    ctx->fill_rects++;
+    ctx->last_fill = rect;
+}
+
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) {
+    if (bitmap == NULL || !bitmap_live(bitmap)) {
+        host_error("graphics_draw_bitmap_in_rect with a destroyed bitmap");
+        return;
+    }
+    ctx->bitmaps++;
+}
+
+// Timers, kept sorted by when they are due
+
+static AppTimer* timer_add(uint32_t timeout_ms, AppTimerCallback callback, void *data, bool reply) {
+    HostTimer *timer = calloc(1, sizeof(HostTimer));
+    *timer = (HostTimer) {
+        .id = ++timer_ids, .due = clock_ms + timeout_ms, .callback = callback, .data = data, .reply = reply
+    };
+    HostTimer **at = &timers;
+    while (*at != NULL && (*at)->due <= timer->due) {
+        at = &(*at)->next;
+    }
+    timer->next = *at;
+    *at = timer;
+    return (AppTimer*) (uintptr_t) timer->id;
+}
+
+AppTimer* app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+    return timer_add(timeout_ms, callback, callback_data, false);
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+    uint32_t id = (uint32_t) (uintptr_t) timer_handle;
+    for (HostTimer **at = &timers; *at != NULL; at = &(*at)->next) {
+        if ((*at)->id == id && !(*at)->reply) {
+            HostTimer *timer = *at;
+            *at = timer->next;
+            free(timer);
+            return;
+        }
+    }
+    host_error("app_timer_cancel on timer %u, which already fired or was cancelled", (unsigned) id);
+}
+
+static void accel_sample(void);
+
+// Handles everything due up to until in time order, redrawing whenever
+// something was marked dirty. Timers go before samples due at the same time.
+static void run_until(uint64_t until) {
+    for (;;) {
+        if (needs_redraw) {
+            host_render();
+        }
+        bool sampling = accel_subscribed && accel_batch > 0;
+        if (timers != NULL && timers->due <= until && (!sampling || timers->due <= accel_next_ms)) {
+            HostTimer *timer = timers;
+            timers = timer->next;
+            clock_ms = timer->due > clock_ms ? timer->due : clock_ms;
+            Dispatch started = dispatch_begin();
+            timer->callback(timer->data);
+            dispatch_end(timer->reply ? HOST_EVENT_APP_MESSAGE : HOST_EVENT_TIMER, 0, started);
+            free(timer);
+        } else if (sampling && accel_next_ms <= until) {
+            clock_ms = accel_next_ms > clock_ms ? accel_next_ms : clock_ms;
+            accel_sample();
+        } else {
+            clock_ms = until > clock_ms ? until : clock_ms;
+            return;
+        }
+    }
+}
+
+void app_event_loop(void) {
+    run_until(clock_ms);
+    if (driver != NULL) {
+        driver();
+    }
+    run_until(clock_ms);
+}
+
+uint64_t host_time_ms(void) {
+    return clock_ms;
+}
+
+void host_set_time(time_t seconds) {
+    clock_ms = (uint64_t) seconds * 1000;
+}
+
+void host_run(uint32_t ms) {
+    run_until(clock_ms + ms);
+}
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms) {
+    if (tloc != NULL) {
+        *tloc = clock_ms / 1000;
+    }
+    if (out_ms != NULL) {
+        *out_ms = clock_ms % 1000;
+    }
+    return clock_ms % 1000;
+}
+
+time_t host_time(time_t *tloc) {
+    time_t seconds = clock_ms / 1000;
+    if (tloc != NULL) {
+        *tloc = seconds;
+    }
+    return seconds;
+}
+
+// Layers and windows
+
+static void layer_init(Layer *layer, LayerKind kind, GRect frame) {
+    *layer = (Layer) { .live = true, .kind = kind, .frame = frame };
+}
+
+static void layer_unlink(Layer *layer) {
+    if (layer->parent == NULL) {
+        return;
+    }
+    Layer **at = &layer->parent->first_child;
+    while (*at != layer) {
+        at = &(*at)->next_sibling;
+    }
+    *at = layer->next_sibling;
+    layer->parent = NULL;
+    layer->next_sibling = NULL;
+    needs_redraw = true;
+}
+
+// Takes a layer being destroyed out of the tree, orphaning its children
+static void layer_detach(Layer *layer) {
+    layer_unlink(layer);
+    for (Layer *child = layer->first_child; child != NULL;) {
+        Layer *next = child->next_sibling;
+        child->parent = NULL;
+        child->next_sibling = NULL;
+        child = next;
+    }
+    layer->first_child = NULL;
+}
+
+Layer* layer_create(GRect frame) {
+    if (!heap_take(HOST_LAYER_BYTES)) {
+        return NULL;
+    }
+    Layer *layer = calloc(1, sizeof(Layer));
+    layer_init(layer, LAYER_PLAIN, frame);
+    return layer;
+}
+
+void layer_destroy(Layer *layer) {
+    if (!layer_check(layer, "layer_destroy")) {
+        return;
+    }
+    layer_detach(layer);
+    layer->live = false;
+    heap_give(HOST_LAYER_BYTES);
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+    if (!layer_check(parent, "layer_add_child") || !layer_check(child, "layer_add_child")) {
+        return;
+    }
+    layer_unlink(child);
+    Layer **at = &parent->first_child;
+    while (*at != NULL) {
+        at = &(*at)->next_sibling;
+    }
+    *at = child;
+    child->parent = parent;
+    needs_redraw = true;
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+    if (layer_check(layer, "layer_set_hidden") && layer->hidden != hidden) {
+        layer->hidden = hidden;
+        needs_redraw = true;
+    }
+}
+
+void layer_mark_dirty(Layer *layer) {
+    if (layer_check(layer, "layer_mark_dirty")) {
+        needs_redraw = true;
+    }
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+    if (!layer_check(layer, "layer_get_bounds")) {
+        return GRect(0, 0, 0, 0);
+    }
+    return GRect(0, 0, layer->frame.size.w, layer->frame.size.h);
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+    if (layer_check(layer, "layer_set_update_proc")) {
+        layer->update_proc = update_proc;
+    }
+}
+
+TextLayer* text_layer_create(GRect frame) {
+    if (!heap_take(HOST_TEXT_LAYER_BYTES)) {
+        return NULL;
+    }
+    TextLayer *text_layer = calloc(1, sizeof(TextLayer));
+    layer_init(&text_layer->layer, LAYER_TEXT, frame);
+    text_layer->font = &system_font;
+    return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) {
+    if (!layer_check(&text_layer->layer, "text_layer_destroy")) {
+        return;
+    }
+    layer_detach(&text_layer->layer);
+    text_layer->layer.live = false;
+    heap_give(HOST_TEXT_LAYER_BYTES);
+}
+
+Layer* text_layer_get_layer(TextLayer *text_layer) {
+    return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text) {
+    if (layer_check(&text_layer->layer, "text_layer_set_text")) {
+        text_layer->text = text;
+        needs_redraw = true;
+    }
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font) {
+    if (layer_check(&text_layer->layer, "text_layer_set_font")) {
+        text_layer->font = font;
+        needs_redraw = true;
+    }
+}
+
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment) {
+    if (layer_check(&text_layer->layer, "text_layer_set_text_alignment")) {
+        text_layer->alignment = text_alignment;
+    }
+}
+
+BitmapLayer* bitmap_layer_create(GRect frame) {
+    if (!heap_take(HOST_BITMAP_LAYER_BYTES)) {
+        return NULL;
+    }
+    BitmapLayer *bitmap_layer = calloc(1, sizeof(BitmapLayer));
+    layer_init(&bitmap_layer->layer, LAYER_BITMAP, frame);
+    return bitmap_layer;
+}
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer) {
+    if (!layer_check(&bitmap_layer->layer, "bitmap_layer_destroy")) {
+        return;
+    }
+    layer_detach(&bitmap_layer->layer);
+    bitmap_layer->layer.live = false;
+    heap_give(HOST_BITMAP_LAYER_BYTES);
+}
+
+Layer* bitmap_layer_get_layer(const BitmapLayer *bitmap_layer) {
+    return (Layer*) &bitmap_layer->layer;
+}
+
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap) {
+    if (layer_check(&bitmap_layer->layer, "bitmap_layer_set_bitmap")) {
+        bitmap_layer->bitmap = bitmap;
+        needs_redraw = true;
+    }
+}
+
+Window* window_create(void) {
+    if (!heap_take(HOST_WINDOW_BYTES)) {
+        return NULL;
+    }
+    Window *window = calloc(1, sizeof(Window));
+    window->live = true;
+    layer_init(&window->root, LAYER_ROOT, GRect(0, 0, HOST_DISPLAY_WIDTH, HOST_DISPLAY_HEIGHT));
+    return window;
+}
+
+static void clicks_configure(void) {
+    memset(clicks, 0, sizeof(clicks));
+    if (top_window != NULL && top_window->click_config_provider != NULL) {
+        configuring_clicks = true;
+        top_window->click_config_provider(top_window);
+        configuring_clicks = false;
+    }
+}
+
+void window_destroy(Window *window) {
+    if (window == NULL || !window->live) {
+        host_error("window_destroy on a destroyed window");
+        return;
+    }
+    if (window == top_window) {
+        if (window->handlers.disappear != NULL) {
+            window->handlers.disappear(window);
+        }
+        if (window->handlers.unload != NULL) {
+            window->handlers.unload(window);
+        }
+        window->loaded = false;
+        top_window = NULL;
+        clicks_configure();
+    }
+    layer_detach(&window->root);
+    window->live = false;
+    heap_give(HOST_WINDOW_BYTES);
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) {
+    window->handlers = handlers;
+}
+
+void window_stack_push(Window *window, bool animated) {
+    if (top_window != NULL) {
+        host_error("window_stack_push: the stub only holds one window");
+        return;
+    }
+    top_window = window;
+    if (window->handlers.load != NULL) {
+        window->handlers.load(window);
+    }
+    window->loaded = true;
+    if (window->handlers.appear != NULL) {
+        window->handlers.appear(window);
+    }
+    clicks_configure();
+    needs_redraw = true;
+}
+
+Layer* window_get_root_layer(const Window *window) {
+    return (Layer*) &window->root;
+}
+
+// Buttons
+
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider) {
+    window->click_config_provider = click_config_provider;
+    // the window on top picks up the new subscriptions at once
+    if (window == top_window && window->loaded) {
+        clicks_configure();
+    }
+}
+
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler) {
+    if (!configuring_clicks) {
+        host_error("window_single_click_subscribe outside a click config provider");
+        return;
+    }
+    clicks[button_id].single = handler;
+}
+
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler,
+                                 ClickHandler up_handler) {
+    if (!configuring_clicks) {
+        host_error("window_long_click_subscribe outside a click config provider");
+        return;
+    }
+    clicks[button_id].long_down = down_handler;
+    clicks[button_id].long_up = up_handler;
+}
+
+static void click_dispatch(HostEvent event, ButtonId button, ClickHandler handler) {
+    if (handler == NULL) {
+        return;
+    }
+    Dispatch started = dispatch_begin();
+    handler(NULL, top_window);
+    dispatch_end(event, button, started);
+}
+
+void host_click(ButtonId button) {
+    // with a long click subscribed a single click can only be told apart
+    // on release, without one it fires as soon as the button goes down
+    if (clicks[button].long_down != NULL || clicks[button].long_up != NULL) {
+        stats.clicks_on_release++;
+        host_run(HOST_CLICK_MS);
+        click_dispatch(HOST_EVENT_CLICK, button, clicks[button].single);
+    } else {
+        click_dispatch(HOST_EVENT_CLICK, button, clicks[button].single);
+        host_run(HOST_CLICK_MS);
+    }
+    run_until(clock_ms);
+}
+
+void host_long_click(ButtonId button) {
+    if (clicks[button].long_down == NULL && clicks[button].long_up == NULL) {
+        click_dispatch(HOST_EVENT_CLICK, button, clicks[button].single);
+        host_run(HOST_LONG_CLICK_MS);
+    } else {
+        host_run(HOST_LONG_CLICK_MS);
+        click_dispatch(HOST_EVENT_LONG_CLICK, button, clicks[button].long_down);
+        click_dispatch(HOST_EVENT_LONG_CLICK, button, clicks[button].long_up);
+    }
+    run_until(clock_ms);
+}
+
+// Accelerometer, vibes and battery
+
+static uint32_t accel_period(void) {
+    return 1000 / accel_rate;
+}
+
+static AccelData accel_now(void) {
+    AccelData sample = accel_held;
+    sample.timestamp = clock_ms;
+    sample.did_vibrate = clock_ms < vibe_until;
+    return sample;
+}
+
+static void accel_sample(void) {
+    accel_buffer[accel_fill++] = accel_now();
+    accel_next_ms += accel_period();
+    if (accel_fill < accel_batch) {
+        return;
+    }
+    AccelData batch[HOST_ACCEL_MAX_BATCH];
+    uint32_t count = accel_fill;
+    memcpy(batch, accel_buffer, count * sizeof(AccelData));
+    accel_fill = 0;
+    stats.accel_samples += count;
+    Dispatch started = dispatch_begin();
+    accel_handler(batch, count);
+    dispatch_end(HOST_EVENT_ACCEL, count, started);
+}
+
+void accel_data_service_subscribe(uint32_t samples_per_update, AccelDataHandler handler) {
+    if (samples_per_update > HOST_ACCEL_MAX_BATCH) {
+        host_error("accel_data_service_subscribe: %u samples per update is over %d",
+                   (unsigned) samples_per_update, HOST_ACCEL_MAX_BATCH);
+        samples_per_update = HOST_ACCEL_MAX_BATCH;
+    }
+    accel_subscribed = true;
+    accel_batch = samples_per_update;
+    accel_handler = handler;
+    accel_rate = HOST_ACCEL_DEFAULT_RATE;
+    accel_fill = 0;
+    accel_next_ms = clock_ms + accel_period();
+}
+
+void accel_data_service_unsubscribe(void) {
+    accel_subscribed = false;
+    accel_fill = 0;
+}
+
+int accel_service_set_sampling_rate(AccelSamplingRate rate) {
+    accel_rate = rate;
+    return 0;
+}
+
+int accel_service_peek(AccelData *data) {
+    stats.accel_peeks++;
+    if (!accel_subscribed || accel_batch > 0) {
+        host_error("accel_service_peek needs a data subscription without samples");
+        return -1;
+    }
+    *data = accel_now();
+    return 0;
+}
+
+void accel_tap_service_subscribe(AccelTapHandler handler) {
+    tap_handler = handler;
+}
+
+void accel_tap_service_unsubscribe(void) {
+    tap_handler = NULL;
+}
+
+void host_accel_play(const AccelData *samples, int count) {
+    for (int i = 0; i < count; i++) {
+        accel_held = samples[i];
+        run_until(clock_ms + accel_period());
+    }
+}
+
+void host_accel_hold(AccelData sample) {
+    accel_held = sample;
+}
+
+void host_tap(AccelAxisType axis, int32_t direction) {
+    if (tap_handler == NULL) {
+        return;
+    }
+    Dispatch started = dispatch_begin();
+    tap_handler(axis, direction);
+    dispatch_end(HOST_EVENT_TAP, axis, started);
+    run_until(clock_ms);
+}
+
+static void vibe(uint32_t ms) {
+    stats.vibes++;
+    vibe_until = clock_ms + ms;
+}
+
+void vibes_short_pulse(void) {
+    vibe(HOST_VIBE_SHORT_MS);
+}
+
+void vibes_long_pulse(void) {
+    vibe(HOST_VIBE_LONG_MS);
+}
+
+void vibes_double_pulse(void) {
+    vibe(HOST_VIBE_DOUBLE_MS);
+}
+
+BatteryChargeState battery_state_service_peek(void) {
+    return battery;
+}
+
+void host_set_battery(uint8_t percent, bool charging) {
+    battery = (BatteryChargeState) { .charge_percent = percent, .is_charging = charging, .is_plugged = charging };
+}
+
+// Resources
+
+static const HostResource* resource_find(uint32_t resource_id) {
+    for (size_t i = 0; i < sizeof(host_resources) / sizeof(host_resources[0]); i++) {
+        if (host_resources[i].id == resource_id) {
+            return &host_resources[i];
+        }
+    }
+    host_error("no resource with id %u", (unsigned) resource_id);
+    return NULL;
+}
+
+ResHandle resource_get_handle(uint32_t resource_id) {
+    return (ResHandle) resource_find(resource_id);
+}
+
+size_t resource_size(ResHandle handle) {
+    return handle != NULL ? ((const HostResource*) handle)->size : 0;
+}
+
+GFont fonts_get_system_font(const char *font_key) {
+    return &system_font;
+}
+
+GFont fonts_load_custom_font(ResHandle handle) {
+    const HostResource *resource = handle;
+    if (resource == NULL || !resource->is_font) {
+        host_error("fonts_load_custom_font on a resource that isn't a font");
+        return NULL;
+    }
+    if (!heap_take(HOST_FONT_BYTES)) {
+        return NULL;
+    }
+    struct FontInfo *font = calloc(1, sizeof(struct FontInfo));
+    font->live = true;
+    return font;
+}
+
+void fonts_unload_custom_font(GFont font) {
+    if (font == NULL || !font->live || font->system) {
+        host_error("fonts_unload_custom_font on a font that isn't loaded");
+        return;
+    }
+    font->live = false;
+    heap_give(HOST_FONT_BYTES);
+}
+
+GBitmap* gbitmap_create_with_resource(uint32_t resource_id) {
+    const HostResource *resource = resource_find(resource_id);
+    if (resource == NULL || resource->is_font) {
+        return NULL;
+    }
+    uint16_t row_size_bytes = (resource->width + 31) / 32 * 4;
+    size_t pixels = row_size_bytes * resource->height;
+    if (!heap_take(HOST_GBITMAP_BYTES + pixels)) {
+        return NULL;
+    }
+    HostBitmap *bitmap = calloc(1, sizeof(HostBitmap));
+    bitmap->bitmap = (GBitmap) {
+        .addr = calloc(1, pixels), .row_size_bytes = row_size_bytes,
+        .bounds = GRect(0, 0, resource->width, resource->height)
+    };
+    bitmap->live = true;
+    bitmap->heap = HOST_GBITMAP_BYTES + pixels;
+    stats.bitmap_loads++;
+    clock_ms += BITMAP_LOAD_COST;
+    return &bitmap->bitmap;
+}
+
+GBitmap* gbitmap_create_as_sub_bitmap(const GBitmap *base_bitmap, GRect sub_rect) {
+    if (base_bitmap == NULL || !bitmap_live(base_bitmap)) {
+        host_error("gbitmap_create_as_sub_bitmap of a destroyed bitmap");
+        return NULL;
+    }
+    if (!heap_take(HOST_GBITMAP_BYTES)) {
+        return NULL;
+    }
+    HostBitmap *bitmap = calloc(1, sizeof(HostBitmap));
+    bitmap->bitmap = *base_bitmap;
+    bitmap->bitmap.bounds = sub_rect;
+    bitmap->live = true;
+    bitmap->parent = (const HostBitmap*) base_bitmap;
+    bitmap->heap = HOST_GBITMAP_BYTES;
+    return &bitmap->bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+    HostBitmap *host = (HostBitmap*) bitmap;
+    if (bitmap == NULL || !host->live) {
+        host_error("gbitmap_destroy on a destroyed bitmap");
+        return;
+    }
+    if (host->parent == NULL) {
+        free(bitmap->addr);
+    }
+    host->live = false;
+    heap_give(host->heap);
+}
+
+// Persistent storage
+
+static PersistEntry* persist_find(uint32_t key) {
+    for (int i = 0; i < HOST_PERSIST_KEYS; i++) {
+        if (persist[i].used && persist[i].key == key) {
+            return &persist[i];
+        }
+    }
+    return NULL;
+}
+
+bool persist_exists(const uint32_t key) {
+    return persist_find(key) != NULL;
+}
+
+int persist_get_size(const uint32_t key) {
+    PersistEntry *entry = persist_find(key);
+    return entry != NULL ? entry->size : E_DOES_NOT_EXIST;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+    PersistEntry *entry = persist_find(key);
+    stats.persist_reads++;
+    if (entry == NULL) {
+        return E_DOES_NOT_EXIST;
+    }
+    size_t copied = entry->size < buffer_size ? entry->size : buffer_size;
+    memcpy(buffer, entry->data, copied);
+    return copied;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+    int32_t value = 0;
+    if (persist_get_size(key) == sizeof(value)) {
+        persist_read_data(key, &value, sizeof(value));
+    }
+    return value;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+    if (size > PERSIST_DATA_MAX_LENGTH) {
+        host_error("persist_write_data of %u bytes to key %u, over %d", (unsigned) size, (unsigned) key,
+                   PERSIST_DATA_MAX_LENGTH);
+        return E_INVALID_ARGUMENT;
+    }
+    PersistEntry *entry = persist_find(key);
+    uint32_t writes = entry != NULL ? entry->writes : 0;
+    size_t stored = size;
+    for (int i = 0; i < HOST_PERSIST_KEYS; i++) {
+        if (persist[i].used && &persist[i] != entry) {
+            stored += persist[i].size;
+        }
+    }
+    if (stored > HOST_PERSIST_STORAGE) {
+        host_error("persist_write_data to key %u: %u bytes stored is over %d", (unsigned) key,
+                   (unsigned) stored, HOST_PERSIST_STORAGE);
+        return E_OUT_OF_STORAGE;
+    }
+    for (int i = 0; entry == NULL && i < HOST_PERSIST_KEYS; i++) {
+        if (!persist[i].used) {
+            entry = &persist[i];
+        }
+    }
+    if (entry == NULL) {
+        host_error("persist_write_data: more than %d keys", HOST_PERSIST_KEYS);
+        return E_OUT_OF_STORAGE;
+    }
+    *entry = (PersistEntry) { .used = true, .key = key, .size = size, .writes = writes + 1 };
+    memcpy(entry->data, data, size);
+    stats.persist_writes++;
+    stats.persist_bytes_written += size;
+    clock_ms += PERSIST_WRITE_COST;
+    return size;
+}
+
+int persist_write_int(const uint32_t key, const int32_t value) {
+    return persist_write_data(key, &value, sizeof(value));
+}
+
+int persist_delete(const uint32_t key) {
+    PersistEntry *entry = persist_find(key);
+    if (entry == NULL) {
+        return E_DOES_NOT_EXIST;
+    }
+    entry->used = false;
+    return S_TRUE;
+}
+
+uint32_t host_persist_writes(uint32_t key) {
+    PersistEntry *entry = persist_find(key);
+    return entry != NULL ? entry->writes : 0;
+}
+
+bool host_persist_save(const char *path) {
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        return false;
+    }
+    for (int i = 0; i < HOST_PERSIST_KEYS; i++) {
+        if (persist[i].used) {
+            fwrite(&persist[i].key, sizeof(persist[i].key), 1, out);
+            fwrite(&persist[i].size, sizeof(persist[i].size), 1, out);
+            fwrite(persist[i].data, 1, persist[i].size, out);
+        }
+    }
+    return fclose(out) == 0;
+}
+
+bool host_persist_load(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return false;
+    }
+    host_persist_clear();
+    PersistEntry entry = { .used = true };
+    for (int i = 0; i < HOST_PERSIST_KEYS && fread(&entry.key, sizeof(entry.key), 1, in) == 1; i++) {
+        if (fread(&entry.size, sizeof(entry.size), 1, in) != 1 || entry.size > PERSIST_DATA_MAX_LENGTH ||
+                fread(entry.data, 1, entry.size, in) != entry.size) {
+            break;
+        }
+        persist[i] = entry;
+    }
+    fclose(in);
+    return true;
+}
+
+void host_persist_clear(void) {
+    memset(persist, 0, sizeof(persist));
+}
+
+// AppMessage and the phone at the other end
+
+#define TUPLE_HEADER_BYTES 7
+#define TUPLE_BYTE_ARRAY 0
+#define TUPLE_UINT 2
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+    if (app_message_opened) {
+        host_error("app_message_open called twice");
+        return APP_MSG_INVALID_ARGS;
+    }
+    if (!heap_take(size_inbound + size_outbound)) {
+        return APP_MSG_OUT_OF_MEMORY;
+    }
+    outbox = calloc(1, size_outbound);
+    outbox_iter = (DictionaryIterator) { .buffer = outbox, .size = size_outbound };
+    app_message_opened = true;
+    return APP_MSG_OK;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent callback) {
+    AppMessageOutboxSent previous = sent_callback;
+    sent_callback = callback;
+    return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed callback) {
+    AppMessageOutboxFailed previous = failed_callback;
+    failed_callback = callback;
+    return previous;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+    if (!app_message_opened) {
+        host_error("app_message_outbox_begin before app_message_open");
+        return APP_MSG_INVALID_ARGS;
+    }
+    if (outbox_busy || outbox_begun) {
+        return APP_MSG_BUSY;
+    }
+    outbox_begun = true;
+    outbox_iter.used = 1;
+    outbox[0] = 0;
+    *iterator = &outbox_iter;
+    return APP_MSG_OK;
+}
+
+static DictionaryResult dict_write(DictionaryIterator *iter, uint32_t key, uint8_t type, const void *data,
+                                   uint16_t size) {
+    if (iter != &outbox_iter || !outbox_begun) {
+        host_error("dict_write_* outside app_message_outbox_begin/send");
+        return DICT_INVALID_ARGS;
+    }
+    if (iter->used + TUPLE_HEADER_BYTES + size > iter->size) {
+        return DICT_NOT_ENOUGH_STORAGE;
+    }
+    uint8_t *tuple = iter->buffer + iter->used;
+    for (int i = 0; i < 4; i++) {
+        tuple[i] = key >> (8 * i);
+    }
+    tuple[4] = type;
+    tuple[5] = size;
+    tuple[6] = size >> 8;
+    memcpy(tuple + TUPLE_HEADER_BYTES, data, size);
+    iter->used += TUPLE_HEADER_BYTES + size;
+    iter->buffer[0]++;
+    return DICT_OK;
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+    uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    return dict_write(iter, key, TUPLE_UINT, bytes, sizeof(bytes));
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t * const data,
+                                 const uint16_t size) {
+    return dict_write(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...) {
+    va_list sizes;
+    uint32_t total = 1 + tuple_count * TUPLE_HEADER_BYTES;
+    va_start(sizes, tuple_count);
+    for (int i = 0; i < tuple_count; i++) {
+        // the watch passes 32 bit sizes, only the low word is meaningful here
+        total += va_arg(sizes, uint32_t);
+    }
+    va_end(sizes);
+    return total;
+}
+
+static void outbox_reply(void *data) {
+    HostReply reply = (HostReply) (uintptr_t) data;
+    outbox_busy = false;
+    if (reply == HOST_REPLY_ACK) {
+        if (sent_callback != NULL) {
+            sent_callback(&outbox_iter, NULL);
+        }
+    } else if (failed_callback != NULL) {
+        failed_callback(&outbox_iter, reply == HOST_REPLY_NACK ? APP_MSG_SEND_REJECTED :
+                        reply == HOST_REPLY_TIMEOUT ? APP_MSG_SEND_TIMEOUT : APP_MSG_NOT_CONNECTED, NULL);
+    }
+}
+
+AppMessageResult app_message_outbox_send(void) {
+    if (!outbox_begun) {
+        host_error("app_message_outbox_send without app_message_outbox_begin");
+        return APP_MSG_INVALID_ARGS;
+    }
+    outbox_begun = false;
+    outbox_busy = true;
+    if (message_count == message_capacity) {
+        message_capacity = message_capacity > 0 ? message_capacity * 2 : 16;
+        messages = realloc(messages, message_capacity * sizeof(HostMessage));
+    }
+    HostMessage *message = &messages[message_count++];
+    message->size = outbox_iter.used;
+    memcpy(message->bytes, outbox, outbox_iter.used);
+    message->sent_ms = clock_ms;
+    message->reply = reply_policy;
+    timer_add(HOST_APP_MESSAGE_LATENCY, outbox_reply, (void*) (uintptr_t) reply_policy, true);
+    return APP_MSG_OK;
+}
+
+void host_set_reply(HostReply reply) {
+    reply_policy = reply;
+}
+
+int host_message_count(void) {
+    return message_count;
+}
+
+const HostMessage* host_message(int index) {
+    return index >= 0 && index < message_count ? &messages[index] : NULL;
+}
+
+bool host_message_tuple(const HostMessage *message, uint32_t key, const uint8_t **data, uint16_t *length) {
+    uint32_t at = 1;
+    for (int i = 0; i < message->bytes[0] && at + TUPLE_HEADER_BYTES <= message->size; i++) {
+        const uint8_t *tuple = message->bytes + at;
+        uint32_t tuple_key = tuple[0] | tuple[1] << 8 | tuple[2] << 16 | (uint32_t) tuple[3] << 24;
+        uint16_t size = tuple[5] | tuple[6] << 8;
+        if (tuple_key == key) {
+            *data = tuple + TUPLE_HEADER_BYTES;
+            *length = size;
+            return true;
+        }
+        at += TUPLE_HEADER_BYTES + size;
+    }
+    return false;
+}
+
+// Logging
+
+void app_log(uint8_t level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    if (level <= APP_LOG_LEVEL_WARNING) {
+        stats.warnings++;
+    }
+    if (level <= log_level) {
+        fprintf(stderr, "[%s:%d] %s\n", src_filename, src_line_number, message);
+    }
+    if (log_hook != NULL) {
+        log_hook(level, message);
+    }
+}
+
+void host_set_log_level(uint8_t level) {
+    log_level = level;
+}
+
+void host_set_log_hook(HostLogHook hook) {
+    log_hook = hook;
+}
+
+const HostStats* host_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+// Stand-in for the Pebble SDK 2 header, covering only what src/ uses, so
+// the watch app compiles and runs on a desktop. Types and return values
+// follow the SDK; behaviour is implemented in pebble.c and driven from
+// host.h. Nothing here is meant to be fast, only faithful enough to catch
+// the mistakes the real SDK would punish.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// RESOURCE_ID_* from appinfo.json, written by gen_headers.py
+#include "src/resource_ids.auto.h"
+
+// Modeled on-watch costs in ms. The stub moves its clock forward by these
+// whenever the app writes flash or decodes a bitmap, so anything timed with
+// time_ms() sees them. Override with -D to match a particular watch.
+#ifndef PERSIST_WRITE_COST
+#define PERSIST_WRITE_COST 8
+#endif
+#ifndef BITMAP_LOAD_COST
+#define BITMAP_LOAD_COST 4
+#endif
+
+typedef enum {
+    S_TRUE = 1,
+    S_FALSE = 0,
+    S_SUCCESS = 0,
+    E_ERROR = -1,
+    E_UNKNOWN = -2,
+    E_INTERNAL = -3,
+    E_INVALID_ARGUMENT = -4,
+    E_OUT_OF_MEMORY = -5,
+    E_OUT_OF_STORAGE = -6,
+    E_OUT_OF_RESOURCES = -7,
+    E_RANGE = -8,
+    E_DOES_NOT_EXIST = -9,
+    E_INVALID_OPERATION = -10,
+    E_BUSY = -11,
+} StatusCode;
+
+// Graphics
+
+typedef struct GPoint {
+    int16_t x;
+    int16_t y;
+} GPoint;
+
+typedef struct GSize {
+    int16_t w;
+    int16_t h;
+} GSize;
+
+typedef struct GRect {
+    GPoint origin;
+    GSize size;
+} GRect;
+
+#define GPoint(x, y) ((GPoint) { (x), (y) })
+#define GSize(w, h) ((GSize) { (w), (h) })
+#define GRect(x, y, w, h) ((GRect) { { (x), (y) }, { (w), (h) } })
+
+// 1 bit per pixel, rows padded to 32 bits, as on the original Pebble
+typedef struct {
+    void *addr;
+    uint16_t row_size_bytes;
+    uint16_t info_flags;
+    GRect bounds;
+} GBitmap;
+
+typedef enum {
+    GColorClear = ~0,
+    GColorBlack = 0,
+    GColorWhite = 1,
+} GColor;
+
+typedef enum {
+    GCornerNone = 0,
+    GCornersAll = 15,
+} GCornerMask;
+
+typedef enum {
+    GTextAlignmentLeft,
+    GTextAlignmentCenter,
+    GTextAlignmentRight,
+} GTextAlignment;
+
+typedef struct GContext GContext;
+typedef struct FontInfo *GFont;
+
+#define FONT_KEY_GOTHIC_18 "RESOURCE_ID_GOTHIC_18"
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+
+GFont fonts_get_system_font(const char *font_key);
+
+// Resources
+
+typedef void *ResHandle;
+
+ResHandle resource_get_handle(uint32_t resource_id);
+size_t resource_size(ResHandle handle);
+GFont fonts_load_custom_font(ResHandle handle);
+void fonts_unload_custom_font(GFont font);
+
+GBitmap* gbitmap_create_with_resource(uint32_t resource_id);
+GBitmap* gbitmap_create_as_sub_bitmap(const GBitmap *base_bitmap, GRect sub_rect);
+void gbitmap_destroy(GBitmap *bitmap);
+
+// Layers and windows
+
+typedef struct Layer Layer;
+typedef struct TextLayer TextLayer;
+typedef struct BitmapLayer BitmapLayer;
+typedef struct Window Window;
+
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+
+Layer* layer_create(GRect frame);
+void layer_destroy(Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_set_hidden(Layer *layer, bool hidden);
+void layer_mark_dirty(Layer *layer);
+GRect layer_get_bounds(const Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+
+TextLayer* text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer* text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment);
+
+BitmapLayer* bitmap_layer_create(GRect frame);
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer);
+Layer* bitmap_layer_get_layer(const BitmapLayer *bitmap_layer);
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap);
+
+typedef void (*WindowHandler)(Window *window);
+
+typedef struct {
+    WindowHandler load;
+    WindowHandler appear;
+    WindowHandler disappear;
+    WindowHandler unload;
+} WindowHandlers;
+
+Window* window_create(void);
+void window_destroy(Window *window);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+void window_stack_push(Window *window, bool animated);
+Layer* window_get_root_layer(const Window *window);
+
+// Buttons
+
+typedef enum {
+    BUTTON_ID_BACK,
+    BUTTON_ID_UP,
+    BUTTON_ID_SELECT,
+    BUTTON_ID_DOWN,
+    NUM_BUTTONS,
+} ButtonId;
+
+typedef void *ClickRecognizerRef;
+typedef void (*ClickHandler)(ClickRecognizerRef recognizer, void *context);
+typedef void (*ClickConfigProvider)(void *context);
+
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider);
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler);
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler,
+                                 ClickHandler up_handler);
+
+// Timers and the event loop
+
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+
+AppTimer* app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+void app_timer_cancel(AppTimer *timer_handle);
+
+void app_event_loop(void);
+
+// The stub's clock, in place of the C library's
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms);
+time_t host_time(time_t *tloc);
+#define time(tloc) host_time(tloc)
+
+// Sensors and vibes
+
+typedef enum {
+    ACCEL_SAMPLING_10HZ = 10,
+    ACCEL_SAMPLING_25HZ = 25,
+    ACCEL_SAMPLING_50HZ = 50,
+    ACCEL_SAMPLING_100HZ = 100,
+} AccelSamplingRate;
+
+typedef enum {
+    ACCEL_AXIS_X = 0,
+    ACCEL_AXIS_Y = 1,
+    ACCEL_AXIS_Z = 2,
+} AccelAxisType;
+
+// milli-g
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    bool did_vibrate;
+    uint64_t timestamp;
+} AccelData;
+
+typedef void (*AccelDataHandler)(AccelData *data, uint32_t num_samples);
+typedef void (*AccelTapHandler)(AccelAxisType axis, int32_t direction);
+
+void accel_data_service_subscribe(uint32_t samples_per_update, AccelDataHandler handler);
+void accel_data_service_unsubscribe(void);
+int accel_service_set_sampling_rate(AccelSamplingRate rate);
+int accel_service_peek(AccelData *data);
+void accel_tap_service_subscribe(AccelTapHandler handler);
+void accel_tap_service_unsubscribe(void);
+
+typedef struct {
+    uint8_t charge_percent;
+    bool is_charging;
+    bool is_plugged;
+} BatteryChargeState;
+
+BatteryChargeState battery_state_service_peek(void);
+
+void vibes_short_pulse(void);
+void vibes_long_pulse(void);
+void vibes_double_pulse(void);
+
+// Persistent storage, PERSIST_DATA_MAX_LENGTH bytes per key
+
+#define PERSIST_DATA_MAX_LENGTH 256
+
+bool persist_exists(const uint32_t key);
+int persist_get_size(const uint32_t key);
+int32_t persist_read_int(const uint32_t key);
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size);
+int persist_write_int(const uint32_t key, const int32_t value);
+int persist_write_data(const uint32_t key, const void *data, const size_t size);
+int persist_delete(const uint32_t key);
+
+// AppMessage, with the phone end in pebble.c
+
+typedef enum {
+    APP_MSG_OK = 0,
+    APP_MSG_SEND_TIMEOUT = 1 << 1,
+    APP_MSG_SEND_REJECTED = 1 << 2,
+    APP_MSG_NOT_CONNECTED = 1 << 3,
+    APP_MSG_APP_NOT_RUNNING = 1 << 4,
+    APP_MSG_INVALID_ARGS = 1 << 5,
+    APP_MSG_BUSY = 1 << 6,
+    APP_MSG_BUFFER_OVERFLOW = 1 << 7,
+    APP_MSG_ALREADY_RELEASED = 1 << 9,
+    APP_MSG_OUT_OF_MEMORY = 1 << 12,
+    APP_MSG_CLOSED = 1 << 13,
+    APP_MSG_INTERNAL_ERROR = 1 << 14,
+} AppMessageResult;
+
+typedef enum {
+    DICT_OK = 0,
+    DICT_NOT_ENOUGH_STORAGE = 1 << 1,
+    DICT_INVALID_ARGS = 1 << 2,
+    DICT_INTERNAL_INCONSISTENCY = 1 << 3,
+    DICT_MALLOC_FAILED = 1 << 4,
+} DictionaryResult;
+
+typedef struct DictionaryIterator DictionaryIterator;
+
+typedef void (*AppMessageOutboxSent)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator *iterator, AppMessageResult reason, void *context);
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback);
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator);
+AppMessageResult app_message_outbox_send(void);
+
+// Bytes a dictionary of tuple_count tuples with these value sizes takes,
+// followed by tuple_count size_t sizes
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...);
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value);
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t * const data,
+                                 const uint16_t size);
+
+// Heap, modeled on the app heap of an original Pebble
+
+size_t heap_bytes_used(void);
+size_t heap_bytes_free(void);
+
+// Logging
+
+typedef enum {
+    APP_LOG_LEVEL_ERROR = 1,
+    APP_LOG_LEVEL_WARNING = 50,
+    APP_LOG_LEVEL_INFO = 100,
+    APP_LOG_LEVEL_DEBUG = 200,
+    APP_LOG_LEVEL_DEBUG_VERBOSE = 255,
+} AppLogLevel;
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#define APP_LOG(level, fmt, args...) app_log(level, __FILE__, __LINE__, fmt, ## args)
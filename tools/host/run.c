@@ -0,0 +1,316 @@
+/*
+ * Runs the watch app on the desktop against the stub SDK in this directory.
+ *
+ *     make -C tools/host
+ *     tools/host/build/legendofxor_host [-p flash] [-l log_level] [script]
+ *
+ * Presses, accelerometer samples and the passing of time come from a
+ * script, or from a built-in day of travel and battles when none is given.
+ * Time is virtual, so a day plays in well under a second. At the end it
+ * prints the cost of every kind of event as key=value lines: real time on
+ * this machine, and modeled time on the watch (flash writes and bitmap
+ * decodes, see PERSIST_WRITE_COST and BITMAP_LOAD_COST in pebble.h).
+ *
+ * -p reads flash from a file before launching and writes it back after,
+ * so several runs continue the same game.
+ *
+ * Script commands, one per line, # starts a comment:
+ *     click up|select|down [times]
+ *     long up|select|down       a long press
+ *     walk steps                synthetic walking, see trace.h
+ *     still seconds             the watch lies still
+ *     wait ms                   time passes, holding the last sample
+ *     trace file                plays a recorded trace (x,y,z per line)
+ *     tap
+ *     battery percent [charging]
+ *     reply ack|nack|timeout|disconnected
+ *                               how the phone answers AppMessages
+ *     fight sword|magic|bow|best
+ *                               presses until the battle is over
+ *     expect welcome|travel|battle|death|journey
+ *                               fails the run unless in that state
+ *     expect released count     fails the run unless that many presses so
+ *                               far waited for the button to come back up
+ *     expect unsaved            fails the run if the game's save, journal
+ *                               or journey log is written before it exits
+ */
+
+#include <unistd.h>
+#include "app.h"
+#include "trace.h"
+
+// Most samples one walk, still or trace command plays
+#define RUN_MAX_SAMPLES 100000
+// Presses a fight gives up after
+#define RUN_MAX_PRESSES 500
+
+// Event kinds costs are reported for
+typedef enum {
+    COST_ATTACK,            // presses in battle
+    COST_QUERY_ACCEL,       // accelerometer batches
+    COST_TRANSITION,        // any event that changed the state, included in the above as well
+    COST_PRESS,             // presses elsewhere
+    COST_TIMER,
+    COST_RENDER,
+    COST_OTHER,
+    COST_COUNT
+} CostKind;
+
+typedef struct {
+    uint32_t count;
+    uint64_t host_ns;
+    uint64_t host_ns_max;
+    uint64_t watch_ms;
+    uint32_t watch_ms_max;
+} Cost;
+
+static const char *cost_names[COST_COUNT] = {
+    "attack", "query_accel", "state_transition", "press", "timer", "render", "other",
+};
+static const char *state_names[STATE_COUNT] = { "battle", "travel", "welcome", "death", "journey" };
+
+static Cost costs[COST_COUNT];
+static int last_state;
+// set by "expect unsaved", checked once the app has exited
+static bool expect_unsaved = false;
+static FILE *script = NULL;
+static AccelData samples[RUN_MAX_SAMPLES];
+static uint32_t sample_seed = 1;
+
+static void cost_add(CostKind kind, uint64_t host_ns, uint32_t watch_ms) {
+    Cost *cost = &costs[kind];
+    cost->count++;
+    cost->host_ns += host_ns;
+    cost->watch_ms += watch_ms;
+    cost->host_ns_max = host_ns > cost->host_ns_max ? host_ns : cost->host_ns_max;
+    cost->watch_ms_max = watch_ms > cost->watch_ms_max ? watch_ms : cost->watch_ms_max;
+}
+
+static void event_cost(HostEvent event, int arg, uint64_t host_ns, uint32_t watch_ms) {
+    bool press = event == HOST_EVENT_CLICK || event == HOST_EVENT_LONG_CLICK;
+    if (press && last_state == BATTLE && event == HOST_EVENT_CLICK) {
+        cost_add(COST_ATTACK, host_ns, watch_ms);
+    } else if (press) {
+        cost_add(COST_PRESS, host_ns, watch_ms);
+    } else if (event == HOST_EVENT_ACCEL) {
+        cost_add(COST_QUERY_ACCEL, host_ns, watch_ms);
+    } else if (event == HOST_EVENT_TIMER) {
+        cost_add(COST_TIMER, host_ns, watch_ms);
+    } else if (event == HOST_EVENT_RENDER) {
+        cost_add(COST_RENDER, host_ns, watch_ms);
+    } else {
+        cost_add(COST_OTHER, host_ns, watch_ms);
+    }
+    if (state != last_state) {
+        cost_add(COST_TRANSITION, host_ns, watch_ms);
+        last_state = state;
+    }
+}
+
+static int parse_button(const char *name) {
+    if (strcmp(name, "up") == 0) {
+        return BUTTON_ID_UP;
+    } else if (strcmp(name, "select") == 0) {
+        return BUTTON_ID_SELECT;
+    } else if (strcmp(name, "down") == 0) {
+        return BUTTON_ID_DOWN;
+    }
+    return -1;
+}
+
+// The button for a weapon, or the one doing the most damage to the target
+static ButtonId fight_button(const char *weapon) {
+    static const ButtonId buttons[WEAPON_COUNT] = {
+        [WEAPON_SWORD] = BUTTON_ID_UP, [WEAPON_MAGIC] = BUTTON_ID_SELECT, [WEAPON_BOW] = BUTTON_ID_DOWN
+    };
+    int best = WEAPON_SWORD;
+    for (int i = 0; i < WEAPON_COUNT; i++) {
+        if (damage_matrix[target][i] > damage_matrix[target][best]) {
+            best = i;
+        }
+    }
+    int button = parse_button(strcmp(weapon, "sword") == 0 ? "up" : strcmp(weapon, "magic") == 0 ? "select" :
+                              strcmp(weapon, "bow") == 0 ? "down" : "");
+    return button >= 0 ? (ButtonId) button : buttons[best];
+}
+
+static void fight(const char *weapon) {
+    for (int presses = 0; state == BATTLE && presses < RUN_MAX_PRESSES; presses++) {
+        host_click(fight_button(weapon));
+    }
+}
+
+static void walk(int steps) {
+    host_accel_play(samples, trace_walk(samples, RUN_MAX_SAMPLES, steps, sample_seed++));
+}
+
+static void still(int seconds) {
+    // a few seconds of noise, then the same reading until the time is up
+    int count = trace_still(samples, RUN_MAX_SAMPLES, seconds < 10 ? seconds * 10 : 100, sample_seed++);
+    host_accel_play(samples, count);
+    host_run(seconds > 10 ? (seconds - 10) * 1000 : 0);
+}
+
+static bool command(const char *line, int number) {
+    char name[32] = "";
+    char arg[256] = "";
+    char extra[32] = "";
+    if (sscanf(line, " %31s %255s %31s", name, arg, extra) < 1 || name[0] == '#') {
+        return true;
+    }
+    int value = atoi(arg);
+    if (strcmp(name, "click") == 0 && parse_button(arg) >= 0) {
+        for (int i = 0; i < (extra[0] != '\0' ? atoi(extra) : 1); i++) {
+            host_click(parse_button(arg));
+        }
+    } else if (strcmp(name, "long") == 0 && parse_button(arg) >= 0) {
+        host_long_click(parse_button(arg));
+    } else if (strcmp(name, "walk") == 0) {
+        walk(value);
+    } else if (strcmp(name, "still") == 0) {
+        still(value);
+    } else if (strcmp(name, "wait") == 0) {
+        host_run(value);
+    } else if (strcmp(name, "trace") == 0) {
+        int count = trace_load(arg, samples, RUN_MAX_SAMPLES);
+        if (count < 0) {
+            fprintf(stderr, "line %d: can't read trace %s\n", number, arg);
+            return false;
+        }
+        host_accel_play(samples, count);
+    } else if (strcmp(name, "tap") == 0) {
+        host_tap(ACCEL_AXIS_Z, 1);
+    } else if (strcmp(name, "battery") == 0) {
+        host_set_battery(value, strcmp(extra, "charging") == 0);
+    } else if (strcmp(name, "reply") == 0) {
+        host_set_reply(strcmp(arg, "nack") == 0 ? HOST_REPLY_NACK : strcmp(arg, "timeout") == 0 ?
+                       HOST_REPLY_TIMEOUT : strcmp(arg, "disconnected") == 0 ? HOST_REPLY_DISCONNECTED :
+                       HOST_REPLY_ACK);
+    } else if (strcmp(name, "fight") == 0) {
+        fight(arg);
+    } else if (strcmp(name, "expect") == 0 && strcmp(arg, "unsaved") == 0) {
+        expect_unsaved = true;
+    } else if (strcmp(name, "expect") == 0 && strcmp(arg, "released") == 0) {
+        if ((int) host_stats()->clicks_on_release != atoi(extra)) {
+            fprintf(stderr, "line %d: expected %s presses on release, got %u\n", number, extra,
+                    (unsigned) host_stats()->clicks_on_release);
+            failures++;
+        }
+    } else if (strcmp(name, "expect") == 0) {
+        if (strcmp(state_names[state], arg) != 0) {
+            fprintf(stderr, "line %d: expected %s, in %s\n", number, arg, state_names[state]);
+            failures++;
+        }
+    } else {
+        fprintf(stderr, "line %d: can't parse \"%s\"\n", number, line);
+        return false;
+    }
+    return true;
+}
+
+static void play_script() {
+    char line[320];
+    for (int number = 1; fgets(line, sizeof(line), script) != NULL; number++) {
+        line[strcspn(line, "\n")] = '\0';
+        if (!command(line, number)) {
+            failures++;
+            return;
+        }
+    }
+}
+
+// Sixteen waking hours: walks of a few hundred steps, fighting whatever
+// turns up with the best weapon, a look at the journey now and then, and
+// long stretches sitting still
+static void play_day() {
+    if (state == WELCOME || state == DEATH) {
+        host_click(BUTTON_ID_SELECT);
+    }
+    if (state == DEATH) {
+        host_click(BUTTON_ID_SELECT);
+    }
+    for (int hour = 0; hour < 16; hour++) {
+        for (int walks = 0; walks < 6; walks++) {
+            walk(100 + 25 * ((hour + walks) % 5));
+            if (state == BATTLE) {
+                fight("best");
+            }
+            // a new run after dying
+            while (state == DEATH || state == WELCOME) {
+                host_click(BUTTON_ID_SELECT);
+            }
+        }
+        if (state == TRAVEL && hour % 4 == 0) {
+            host_click(BUTTON_ID_SELECT);
+            host_run(5000);
+            host_click(BUTTON_ID_SELECT);
+        }
+        still(40 * 60);
+    }
+}
+
+static void driver() {
+    last_state = state;
+    if (script != NULL) {
+        play_script();
+    } else {
+        play_day();
+    }
+}
+
+static void report_costs() {
+    for (int i = 0; i < COST_COUNT; i++) {
+        Cost *cost = &costs[i];
+        printf("event name=%s count=%u host_ns_avg=%llu host_ns_max=%llu watch_ms_avg=%llu watch_ms_max=%u\n",
+               cost_names[i], (unsigned) cost->count,
+               (unsigned long long) (cost->count > 0 ? cost->host_ns / cost->count : 0),
+               (unsigned long long) cost->host_ns_max,
+               (unsigned long long) (cost->count > 0 ? cost->watch_ms / cost->count : 0),
+               (unsigned) cost->watch_ms_max);
+    }
+    const HostStats *stats = host_stats();
+    printf("run virtual_s=%llu state=%s persist_writes=%u persist_bytes=%u bitmap_loads=%u vibes=%u "
+           "accel_samples=%u clicks_on_release=%u frames=%u heap_high_water=%u messages=%d "
+           "warnings=%u errors=%u failures=%d\n",
+           (unsigned long long) (host_time_ms() / 1000 - HOST_EPOCH), state_names[state],
+           (unsigned) stats->persist_writes, (unsigned) stats->persist_bytes_written,
+           (unsigned) stats->bitmap_loads, (unsigned) stats->vibes, (unsigned) stats->accel_samples,
+           (unsigned) stats->clicks_on_release, (unsigned) stats->frames, (unsigned) stats->heap_high_water,
+           host_message_count(), (unsigned) stats->warnings, (unsigned) stats->errors, failures);
+}
+
+int main(int argc, char **argv) {
+    const char *flash = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:")) != -1) {
+        if (opt == 'p') {
+            flash = optarg;
+        } else if (opt == 'l') {
+            host_set_log_level(atoi(optarg));
+        } else {
+            fprintf(stderr, "usage: %s [-p flash] [-l log_level] [script]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind < argc && (script = fopen(argv[optind], "r")) == NULL) {
+        fprintf(stderr, "can't read %s\n", argv[optind]);
+        return 2;
+    }
+    if (flash != NULL) {
+        host_persist_load(flash);
+    }
+    host_set_event_hook(event_cost);
+    host_set_driver(driver);
+    legendofxor_main();
+    if (flash != NULL && !host_persist_save(flash)) {
+        fprintf(stderr, "can't write %s\n", flash);
+        failures++;
+    }
+    if (expect_unsaved && (host_persist_writes(SAVE_KEY) > 0 || host_persist_writes(JOURNAL_KEY) > 0 ||
+                           host_persist_writes(JOURNEY_KEY) > 0)) {
+        fprintf(stderr, "expected no writes to the save, journal or journey log\n");
+        failures++;
+    }
+    report_costs();
+    return failures > 0 || host_stats()->errors > 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Checks the integer combat math against the float formulas it replaced,
+ * for every monster in monsters.csv, and counts the cycles attack() and the
+ * health bar's draw take on this machine, next to those of the float code.
+ * A desktop has a float unit, so the two come out close here, unlike on the
+ * watch's soft float. Run it with:
+ *
+ *     make -C tools/host test
+ *
+ * Prints one "test name=... value=... limit=... result=ok|FAIL" line per
+ * check and exits non-zero when any fails.
+ */
+
+#include <math.h>
+#include "app.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#include <time.h>
+// nanoseconds where there is no cycle counter to read
+static uint64_t cycles() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#endif
+
+// Player damage stats the resistance math is checked for
+#define TEST_MAX_DAMAGE 1000
+// The old hit roll may differ from the per-mille one by this many 2^-24ths,
+// from rounding rand() to a float's 24 bits
+#define TEST_HIT_ERROR 8
+#define TEST_ATTACKS 10000
+#define TEST_DRAWS 10000
+// Cycles per call, far above what a desktop needs so only a change in
+// complexity trips them
+#define TEST_ATTACK_CYCLES 20000
+#define TEST_DRAW_CYCLES 20000
+
+static const int weapon_types[WEAPON_COUNT] = { SWORD_DAMAGE, MAGIC_DAMAGE, BOW_DAMAGE };
+
+// The float formulas, as they were before hit chances became per-mille
+
+static float float_rng(int random) {
+    return (float) random / (float) RAND_MAX;
+}
+
+static int float_resisted(int damage) {
+    return (int) ((float) damage / 5.0);
+}
+
+static int float_bar_width(int health, int max) {
+    float percent_health = ((float) health) / ((float) max);
+    return (int) (percent_health * 75.0);
+}
+
+// The old health bar update proc
+static void float_health_update(Layer *layer, GContext *ctx) {
+    graphics_context_set_fill_color(ctx, GColorBlack);
+    float percent_health = ((float) enemies[target].health) / ((float) current_battle->health);
+    graphics_fill_rect(ctx, GRect(0, 0, (int) (percent_health * 75.0), 4), 0, GCornerNone);
+}
+
+// The math of one attack, the player's hit and the monster's counterattack,
+// with float and integer formulas. Not inlined, so both are timed as calls.
+__attribute__((noinline)) static int float_attack_math(const Monster *monster, int damage, int type, int random) {
+    bool resists = (monster->resistances & type) != 0;
+    bool hits = float_rng(random) < monster->hit_chance / 1000.0f;
+    return (resists ? float_resisted(damage) : damage) + hits;
+}
+
+__attribute__((noinline)) static int int_attack_math(const Monster *monster, int damage, int type, int random) {
+    return combat_damage(damage, monster, type) + combat_monster_hits(monster, random % 1000);
+}
+
+// How many of rand()'s values the float roll counted as a hit. The roll only
+// grows with rand(), so the first miss is found by bisection.
+static uint32_t float_hits(float hit_chance) {
+    uint32_t low = 0;
+    uint32_t high = (uint32_t) RAND_MAX + 1;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (float_rng(middle) < hit_chance) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void check_damage(const Monster *monster, char *labels) {
+    int mismatches = 0;
+    for (int weapon = 0; weapon < WEAPON_COUNT; weapon++) {
+        bool resists = (monster->resistances & weapon_types[weapon]) != 0;
+        for (int damage = 0; damage <= TEST_MAX_DAMAGE; damage++) {
+            int expected = resists ? float_resisted(damage) : damage;
+            mismatches += combat_damage(damage, monster, weapon_types[weapon]) != expected;
+        }
+    }
+    result("damage_mismatches", labels, mismatches, 0);
+}
+
+static void check_hit_chance(const Monster *monster, char *labels) {
+    int hits = 0;
+    for (int roll = 0; roll < 1000; roll++) {
+        hits += combat_monster_hits(monster, roll);
+    }
+    result("hit_roll_mismatches", labels, abs(hits - monster->hit_chance), 0);
+    double float_chance = float_hits(monster->hit_chance / 1000.0f) / ((double) RAND_MAX + 1);
+    double error = fabs(float_chance - monster->hit_chance / 1000.0);
+    result("hit_chance_error_2^-24", labels, (long long) ceil(error * (1 << 24)), TEST_HIT_ERROR);
+}
+
+// Draws the bar at every health the monster can have, through the game's
+// own update proc, and compares the width drawn with the float one
+static void check_bar(int monster, char *labels) {
+    int mismatches = 0;
+    for (int health = 0; health <= monster_index[monster].health; health++) {
+        enemies[target].health = health;
+        bar_stop();
+        GContext *ctx = host_graphics_context();
+        monster_health_update(monster_health_layer, ctx);
+        mismatches += ctx->last_fill.size.w != float_bar_width(health, monster_index[monster].health);
+    }
+    enemies[target].health = monster_index[monster].health;
+    bar_stop();
+    result("bar_mismatches", labels, mismatches, 0);
+}
+
+// A battle against one monster, with the stats a run starts with
+static void battle_enter(int monster) {
+    if (state != TRAVEL) {
+        state_transition(TRAVEL);
+    }
+    battle_arena_reset();
+    stats_reset();
+    encounter_start(1);
+    enemies[0] = (Enemy) { .monster = monster, .health = monster_index[monster].health };
+    state_transition(BATTLE);
+    host_run(HOST_CLICK_MS);
+}
+
+// Attacks that neither end the battle nor the run, the common case. The
+// math alone is timed as well over the same attacks, with the float
+// formulas and the integer ones, a whole loop at a time so reading the
+// counter doesn't swamp them.
+static void time_attack(int monster, char *labels) {
+    static int randoms[TEST_ATTACKS];
+    const Monster *stats = &monster_index[monster];
+    uint64_t total = 0;
+    for (int i = 0; i < TEST_ATTACKS; i++) {
+        randoms[i] = rand();
+        enemies[target].health = stats->health;
+        current_player_health = player_max_health;
+        uint64_t started = cycles();
+        attack(i % WEAPON_COUNT);
+        total += cycles() - started;
+    }
+    result("attack_cycles", labels, total / TEST_ATTACKS, TEST_ATTACK_CYCLES);
+
+    volatile int sink = 0;
+    uint64_t started = cycles();
+    for (int i = 0; i < TEST_ATTACKS; i++) {
+        sink += float_attack_math(stats, i % TEST_MAX_DAMAGE, weapon_types[i % WEAPON_COUNT], randoms[i]);
+    }
+    result("attack_math_float_cycles", labels, (cycles() - started) / TEST_ATTACKS, TEST_ATTACK_CYCLES);
+    started = cycles();
+    for (int i = 0; i < TEST_ATTACKS; i++) {
+        sink += int_attack_math(stats, i % TEST_MAX_DAMAGE, weapon_types[i % WEAPON_COUNT], randoms[i]);
+    }
+    result("attack_math_cycles", labels, (cycles() - started) / TEST_ATTACKS, TEST_ATTACK_CYCLES);
+}
+
+// The bar's update proc against the float one it replaced
+static void time_draw(char *labels) {
+    GContext *ctx = host_graphics_context();
+    uint64_t started = cycles();
+    for (int i = 0; i < TEST_DRAWS; i++) {
+        monster_health_update(monster_health_layer, ctx);
+    }
+    result("draw_health_bar_cycles", labels, (cycles() - started) / TEST_DRAWS, TEST_DRAW_CYCLES);
+    started = cycles();
+    for (int i = 0; i < TEST_DRAWS; i++) {
+        float_health_update(monster_health_layer, ctx);
+    }
+    result("draw_health_bar_float_cycles", labels, (cycles() - started) / TEST_DRAWS, TEST_DRAW_CYCLES);
+}
+
+static void driver() {
+    // the float bar was always 75 pixels wide
+    result("bar_width_mismatch", "", abs(HEALTH_BAR_WIDTH - 75), 0);
+    for (int monster = 0; monster < MONSTER_COUNT; monster++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "monster=%d", monster);
+        check_damage(&monster_index[monster], labels);
+        check_hit_chance(&monster_index[monster], labels);
+        battle_enter(monster);
+        check_bar(monster, labels);
+        time_attack(monster, labels);
+        time_draw(labels);
+    }
+    if (state == BATTLE) {
+        state_transition(TRAVEL);
+    }
+}
+
+int main(int argc, char **argv) {
+    host_set_driver(driver);
+    legendofxor_main();
+    result("host_errors", "", host_stats()->errors, 0);
+    return failures > 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Checks what src/telemetry.c sends to the phone, through the stub's fake
+ * AppMessage endpoint: when batches go out, the order and encoding of the
+ * events in them, sequence numbers and re-sends after a failure, and the
+ * bytes on the air.
+ *
+ *     make -C tools/host test
+ *
+ * Prints one "test name=... value=... expected=... result=ok|FAIL" line per
+ * check and exits non-zero when any fails.
+ */
+
+#include "app.h"
+
+// Must match the wire format in telemetry.c
+#define HEADER_BYTES 6
+#define EVENT_BYTES 6
+// Bytes dict_calc_buffer_size() adds: one for the count, seven per tuple
+#define DICT_HEADER_BYTES 1
+#define TUPLE_HEADER_BYTES 7
+
+// One batch as the phone decodes it
+typedef struct {
+    uint32_t seq;
+    uint32_t time;
+    uint16_t dropped;
+    int count;
+    uint8_t type[TELEMETRY_BATCH];
+    uint8_t arg[TELEMETRY_BATCH];
+    uint16_t value[TELEMETRY_BATCH];
+    uint16_t offset[TELEMETRY_BATCH];
+    uint32_t payload_bytes;
+    uint32_t message_bytes;
+} Batch;
+
+// Events recorded so far, arg and value are both derived from it
+static int recorded = 0;
+
+static uint16_t get16(const uint8_t *in) {
+    return in[0] | in[1] << 8;
+}
+
+static bool batch_decode(int index, Batch *batch) {
+    const HostMessage *message = host_message(index);
+    const uint8_t *seq, *payload;
+    uint16_t seq_length, payload_length;
+    if (message == NULL || !host_message_tuple(message, TELEMETRY_SEQ_KEY, &seq, &seq_length) ||
+            !host_message_tuple(message, TELEMETRY_EVENTS_KEY, &payload, &payload_length) ||
+            seq_length != sizeof(uint32_t) || payload_length < HEADER_BYTES) {
+        return false;
+    }
+    *batch = (Batch) {
+        .seq = get16(seq) | (uint32_t) get16(seq + 2) << 16,
+        .time = get16(payload) | (uint32_t) get16(payload + 2) << 16,
+        .dropped = get16(payload + 4),
+        .count = (payload_length - HEADER_BYTES) / EVENT_BYTES,
+        .payload_bytes = payload_length,
+        .message_bytes = message->size,
+    };
+    for (int i = 0; i < batch->count && i < TELEMETRY_BATCH; i++) {
+        const uint8_t *event = payload + HEADER_BYTES + i * EVENT_BYTES;
+        batch->type[i] = event[0];
+        batch->arg[i] = event[1];
+        batch->value[i] = get16(event + 2);
+        batch->offset[i] = get16(event + 4);
+    }
+    return true;
+}
+
+static void record(int count) {
+    for (int i = 0; i < count; i++) {
+        telemetry_record(TELEMETRY_STAT_GAIN, recorded % 256, 1000 + recorded);
+        recorded++;
+    }
+}
+
+// Checks a batch holds first, first + 1, ... in order, and its size on the air
+static void expect_batch(const char *name, int index, uint32_t seq, int first, int count) {
+    Batch batch;
+    char check[64];
+    snprintf(check, sizeof(check), "%s_decodes", name);
+    expect(check, batch_decode(index, &batch), true);
+    snprintf(check, sizeof(check), "%s_seq", name);
+    expect(check, batch.seq, seq);
+    snprintf(check, sizeof(check), "%s_events", name);
+    expect(check, batch.count, count);
+    int out_of_order = 0;
+    for (int i = 0; i < batch.count && i < TELEMETRY_BATCH; i++) {
+        out_of_order += batch.type[i] != TELEMETRY_STAT_GAIN || batch.arg[i] != (first + i) % 256 ||
+                        batch.value[i] != 1000 + first + i;
+    }
+    snprintf(check, sizeof(check), "%s_out_of_order", name);
+    expect(check, out_of_order, 0);
+    snprintf(check, sizeof(check), "%s_payload_bytes", name);
+    expect(check, batch.payload_bytes, HEADER_BYTES + count * EVENT_BYTES);
+    snprintf(check, sizeof(check), "%s_message_bytes", name);
+    expect(check, batch.message_bytes, DICT_HEADER_BYTES + 2 * TUPLE_HEADER_BYTES + sizeof(uint32_t) +
+           HEADER_BYTES + count * EVENT_BYTES);
+}
+
+static void driver() {
+    // a batch waits for TELEMETRY_BATCH_MIN events
+    record(TELEMETRY_BATCH_MIN - 1);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+    expect("below_batch_min_messages", host_message_count(), 0);
+    record(1);
+    expect("batch_min_messages", host_message_count(), 1);
+    expect_batch("batch_min", 0, 0, 0, TELEMETRY_BATCH_MIN);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+
+    // ...or for the oldest to have waited TELEMETRY_MAX_WAIT, with the time
+    // of each event after the first
+    int first = recorded;
+    record(1);
+    host_run(10 * 1000);
+    record(1);
+    host_run(TELEMETRY_MAX_WAIT - 10 * 1000 - 1);
+    expect("before_max_wait_messages", host_message_count(), 1);
+    host_run(1);
+    expect("max_wait_messages", host_message_count(), 2);
+    expect_batch("max_wait", 1, 1, first, 2);
+    Batch batch;
+    batch_decode(1, &batch);
+    expect("max_wait_offset", batch.offset[1], 10);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+
+    // a failed batch goes out again with the same sequence number and
+    // events, after a back-off that doubles
+    host_set_reply(HOST_REPLY_NACK);
+    first = recorded;
+    record(TELEMETRY_BATCH_MIN);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+    host_run(TELEMETRY_RETRY_MIN - 1);
+    expect("retry_wait_messages", host_message_count(), 3);
+    host_run(1);
+    expect("retry_messages", host_message_count(), 4);
+    expect_batch("retry", 3, 2, first, TELEMETRY_BATCH_MIN);
+    host_run(HOST_APP_MESSAGE_LATENCY + 2 * TELEMETRY_RETRY_MIN - 1);
+    expect("second_retry_wait_messages", host_message_count(), 4);
+    host_set_reply(HOST_REPLY_ACK);
+    host_run(1);
+    expect("second_retry_messages", host_message_count(), 5);
+    expect_batch("second_retry", 4, 2, first, TELEMETRY_BATCH_MIN);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+
+    // a full buffer goes out TELEMETRY_BATCH events at a time, and counts
+    // what it had to drop. The batch being retried was first sent before
+    // the drops, so they go with the one after it.
+    host_set_reply(HOST_REPLY_DISCONNECTED);
+    first = recorded;
+    record(TELEMETRY_LENGTH);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+    int sent = host_message_count();
+    int dropped = 3;
+    for (int i = 0; i < dropped; i++) {
+        telemetry_record(TELEMETRY_STAT_GAIN, 0, 0);
+    }
+    host_set_reply(HOST_REPLY_ACK);
+    host_run(TELEMETRY_RETRY_MAX);
+    expect("full_messages", host_message_count(), sent + 2);
+    expect_batch("full", sent, 3, first, TELEMETRY_BATCH);
+    batch_decode(sent, &batch);
+    expect("full_dropped", batch.dropped, 0);
+    host_run(TELEMETRY_MAX_WAIT);
+    expect_batch("full_rest", sent + 1, 4, first + TELEMETRY_BATCH, TELEMETRY_LENGTH - TELEMETRY_BATCH);
+    batch_decode(sent + 1, &batch);
+    expect("full_rest_dropped", batch.dropped, dropped);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+
+    // a re-send says it dropped what the first send did, even when more
+    // were dropped in between, since the phone only reads it once per
+    // sequence number
+    host_set_reply(HOST_REPLY_NACK);
+    first = recorded;
+    record(TELEMETRY_LENGTH);
+    host_run(HOST_APP_MESSAGE_LATENCY);
+    sent = host_message_count();
+    batch_decode(sent - 1, &batch);
+    expect("resent_first_seq", batch.seq, 5);
+    expect("resent_first_dropped", batch.dropped, 0);
+    for (int i = 0; i < dropped; i++) {
+        telemetry_record(TELEMETRY_STAT_GAIN, 0, 0);
+    }
+    host_set_reply(HOST_REPLY_ACK);
+    host_run(TELEMETRY_RETRY_MIN + HOST_APP_MESSAGE_LATENCY + TELEMETRY_MAX_WAIT);
+    expect("resent_messages", host_message_count(), sent + 2);
+    expect_batch("resent", sent, 5, first, TELEMETRY_BATCH);
+    batch_decode(sent, &batch);
+    expect("resent_dropped", batch.dropped, 0);
+    expect_batch("resent_rest", sent + 1, 6, first + TELEMETRY_BATCH, TELEMETRY_LENGTH - TELEMETRY_BATCH);
+    batch_decode(sent + 1, &batch);
+    expect("resent_rest_dropped", batch.dropped, dropped);
+}
+
+int main(int argc, char **argv) {
+    telemetry_load();
+    telemetry_open();
+    host_set_driver(driver);
+    app_event_loop();
+    telemetry_deinit();
+    expect("host_errors", host_stats()->errors, 0);
+    return failures > 0;
+}
@@ -0,0 +1,53 @@
+#include "trace.h"
+
+// Added to the magnitude over one step, from heel strike to swing
+static const int16_t step_shape[TRACE_STEP_SAMPLES] = { 40, 380, 120, -240, -200 };
+
+static int noise(uint32_t *seed, int range) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return (int) (*seed % (2 * range + 1)) - range;
+}
+
+int trace_walk(AccelData *out, int max, int steps, uint32_t seed) {
+    uint32_t state = seed != 0 ? seed : 1;
+    int count = 0;
+    for (int step = 0; step < steps; step++) {
+        for (int i = 0; i < TRACE_STEP_SAMPLES && count < max; i++) {
+            out[count++] = (AccelData) {
+                .x = 120 + noise(&state, 30),
+                .y = -80 + noise(&state, 30),
+                .z = -(1000 + step_shape[i]) + noise(&state, 20),
+            };
+        }
+    }
+    return count;
+}
+
+int trace_still(AccelData *out, int max, int samples, uint32_t seed) {
+    uint32_t state = seed != 0 ? seed : 1;
+    int count = 0;
+    while (count < samples && count < max) {
+        out[count++] = (AccelData) { .x = noise(&state, 4), .y = noise(&state, 4), .z = -1000 + noise(&state, 4) };
+    }
+    return count;
+}
+
+int trace_load(const char *path, AccelData *out, int max) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return -1;
+    }
+    char line[128];
+    int count = 0;
+    while (count < max && fgets(line, sizeof(line), in) != NULL) {
+        int x, y, z;
+        if (line[0] == '#' || sscanf(line, "%d,%d,%d", &x, &y, &z) != 3) {
+            continue;
+        }
+        out[count++] = (AccelData) { .x = x, .y = y, .z = z };
+    }
+    fclose(in);
+    return count;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <pebble.h>
+
+// Accelerometer traces for host_accel_play(), in milli-g at 10Hz
+
+// Samples per step when walking, about two steps a second
+#define TRACE_STEP_SAMPLES 5
+
+// Walking with the watch on the wrist: a heel strike every step over
+// gravity, with noise from seed. Returns the number of samples written.
+int trace_walk(AccelData *out, int max, int steps, uint32_t seed);
+// Resting on a table, with sensor noise only
+int trace_still(AccelData *out, int max, int samples, uint32_t seed);
+// Reads a recorded trace, one "x,y,z" sample per line. Blank lines and
+// lines starting with # are skipped. Returns -1 when it can't be read.
+int trace_load(const char *path, AccelData *out, int max);
@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+"""Packs same-height PNG icons left to right into one atlas PNG.
+
+    tools/pack_atlas.py resources/ui/weapons.png resources/ui/sword.png \\
+        resources/ui/magic.png resources/ui/bow.png
+
+Prints the source rectangle of each icon, in order. wscript generates the
+same rectangles into src/weapon_atlas.auto.h from WEAPON_ICONS, and fails
+the build when the atlas no longer matches them. Only handles the 8-bit,
+non-interlaced RGB and RGBA PNGs the art is saved as, so it needs nothing
+beyond the standard library.
+"""
+
+import struct
+import sys
+import zlib
+
+CHANNELS = {2: 3, 6: 4}
+
+
+def read_png(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:8] != b'\x89PNG\r\n\x1a\n':
+        raise ValueError('%s: not a PNG' % path)
+    pos, idat = 8, b''
+    while pos < len(data):
+        length, kind = struct.unpack('>I4s', data[pos:pos + 8])
+        body = data[pos + 8:pos + 8 + length]
+        if kind == b'IHDR':
+            width, height, depth, color, _, _, interlace = struct.unpack('>IIBBBBB', body)
+            if depth != 8 or color not in CHANNELS or interlace:
+                raise ValueError('%s: only 8-bit non-interlaced RGB(A) is supported' % path)
+        elif kind == b'IDAT':
+            idat += body
+        pos += 12 + length
+
+    # undo the per-row filters, then expand to RGBA
+    channels = CHANNELS[color]
+    stride = width * channels
+    raw = bytearray(zlib.decompress(idat))
+    rows, prev = [], bytearray(stride)
+    for y in range(height):
+        kind = raw[y * (stride + 1)]
+        row = raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)]
+        for x in range(stride):
+            a = row[x - channels] if x >= channels else 0
+            b = prev[x]
+            c = prev[x - channels] if x >= channels else 0
+            if kind == 1:
+                row[x] = (row[x] + a) & 0xff
+            elif kind == 2:
+                row[x] = (row[x] + b) & 0xff
+            elif kind == 3:
+                row[x] = (row[x] + (a + b) // 2) & 0xff
+            elif kind == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                row[x] = (row[x] + (a if pa <= pb and pa <= pc else b if pb <= pc else c)) & 0xff
+        prev = row
+        if channels == 3:
+            row = bytearray(b''.join(bytes(row[i:i + 3]) + b'\xff' for i in range(0, stride, 3)))
+        rows.append(row)
+    return width, height, rows
+
+
+def write_png(path, width, height, rows):
+    def chunk(kind, body):
+        return (struct.pack('>I', len(body)) + kind + body +
+                struct.pack('>I', zlib.crc32(kind + body) & 0xffffffff))
+    raw = b''.join(b'\x00' + bytes(row) for row in rows)
+    with open(path, 'wb') as f:
+        f.write(b'\x89PNG\r\n\x1a\n')
+        f.write(chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 6, 0, 0, 0)))
+        f.write(chunk(b'IDAT', zlib.compress(raw, 9)))
+        f.write(chunk(b'IEND', b''))
+
+
+def main(out, icons):
+    images = [read_png(icon) for icon in icons]
+    height = images[0][1]
+    if any(h != height for _, h, _ in images):
+        raise ValueError('all icons must be the same height')
+    rows = [bytearray() for _ in range(height)]
+    x = 0
+    for icon, (width, _, pixels) in zip(icons, images):
+        for y in range(height):
+            rows[y] += pixels[y]
+        print('%s: { { %d, 0 }, { %d, %d } }' % (icon, x, width, height))
+        x += width
+    write_png(out, x, height, rows)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    main(sys.argv[1], sys.argv[2:])